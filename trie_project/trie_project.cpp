@@ -6,6 +6,50 @@
 #include <unordered_map>
 #include <climits>
 #include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <queue>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <list>
+#include <map>
+#include <unordered_set>
+#include <functional>
+#include <sstream>
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <condition_variable>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Libraries for memory-mapped snapshots
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Libraries for the query server
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cerrno>
+#include <csignal>
+#endif
 
 // Libraries for unit tests
 #include <cassert>
@@ -36,113 +80,245 @@ void log(const string& message, const string& color = WHITE, const string& style
 
 // Cache manager for storing the suggestions of prefixes
 struct CacheNode {
+    string prefix;
     vector<string> suggestions;
     int frequency;
 
-    CacheNode() : frequency(0) {}
+    // Entries of the same group can be invalidated together, -1 if the entry has none
+    int group;
+
+    // Tells if writing a word changes the suggestions, see CacheManager::removeAffected().
+    // Empty if any write of the group does
+    function<bool(const string&)> affectedBy;
+
+    CacheNode() : frequency(0), group(-1) {}
 };
 
+// LFU cache of suggestions, split into shards with a lock each so that threads looking up
+// different prefixes rarely wait for each other. Inside a shard the entries sit in buckets
+// of equal frequency ordered from the lowest, each bucket in the order its entries arrived,
+// so the least frequently (then least recently) used entry is the front of the first bucket
+// and lookups, insertions and evictions are all O(1)
 class CacheManager {
 private:
-    unordered_map<string, CacheNode> cache;
-    int size;
-    int capacity;
+    struct FrequencyBucket {
+        int frequency;
+        list<CacheNode> entries;
+    };
+
+    typedef list<FrequencyBucket>::iterator BucketIterator;
+    typedef list<CacheNode>::iterator EntryIterator;
+
+    struct Shard {
+        mutex lock;
+        list<FrequencyBucket> buckets;
+        unordered_map<string, pair<BucketIterator, EntryIterator>> index;
+        unordered_map<int, unordered_set<string>> groups;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    size_t capacity;
+    size_t shardCapacity;
+    atomic<size_t> size;
+
+    // Bumped by every invalidation, so results computed before it are not cached after it
+    atomic<uint64_t> generation;
 	bool enableLogging;
+
+    Shard& shardOf(const string& prefix) {
+        return *shards[hash<string>()(prefix) % shards.size()];
+    }
+
+    // Move an entry into the bucket of the next frequency
+    void touch(Shard& shard, BucketIterator bucket, EntryIterator entry) {
+        BucketIterator next = std::next(bucket);
+
+        if (next == shard.buckets.end() || next->frequency != bucket->frequency + 1) {
+            next = shard.buckets.insert(next, { bucket->frequency + 1, {} });
+        }
+
+        next->entries.splice(next->entries.end(), bucket->entries, entry);
+        entry->frequency++;
+        shard.index[entry->prefix] = { next, entry };
+
+        if (bucket->entries.empty()) shard.buckets.erase(bucket);
+    }
+
+    void erase(Shard& shard, BucketIterator bucket, EntryIterator entry) {
+        if (entry->group >= 0) {
+            auto group = shard.groups.find(entry->group);
+
+            group->second.erase(entry->prefix);
+            if (group->second.empty()) shard.groups.erase(group);
+        }
+
+        shard.index.erase(entry->prefix);
+        bucket->entries.erase(entry);
+        size--;
+
+        if (bucket->entries.empty()) shard.buckets.erase(bucket);
+    }
+
 public:
-    CacheManager(int capacity) : size(0), capacity(capacity), enableLogging(true) {}
+    CacheManager(size_t capacity, int shardCount = 1) : capacity(capacity), size(0), generation(0), enableLogging(true) {
+        shardCount = max(1, shardCount);
+        shardCapacity = max<size_t>(1, (capacity + shardCount - 1) / shardCount);
+
+        for (int i = 0; i < shardCount; i++) shards.emplace_back(new Shard());
+    }
 
-    int getSize() {
+    size_t getSize() {
         return size;
     }
 
-    int getCapacity() {
+    size_t getCapacity() {
         return capacity;
     }
 
+    uint64_t getGeneration() {
+        return generation;
+    }
+
 	void setLogging(bool enable) {
 		enableLogging = enable;
 	}
 
-    // Insert a new prefix to the cache
-    void insert(const string& prefix, const vector<string>& suggestions) {
+    // Copy the first "wordLimit" cached suggestions of a prefix and count the hit. Fails if
+    // the prefix is not cached or has fewer suggestions than asked for
+    bool get(const string& prefix, int wordLimit, vector<string>& suggestions) {
+        Shard& shard = shardOf(prefix);
+        lock_guard<mutex> lock(shard.lock);
+
+        auto found = shard.index.find(prefix);
+        if (found == shard.index.end()) return false;
+
+        const vector<string>& cached = found->second.second->suggestions;
+        if (cached.empty() || cached.size() < (size_t)wordLimit) return false;
+
+        suggestions.assign(cached.begin(), cached.begin() + wordLimit);
+        touch(shard, found->second.first, found->second.second);
+
+        return true;
+    }
+
+    // Insert or replace the suggestions of a prefix, evicting the least frequently used
+    // entry of the shard when it is full. Nothing is stored if the cache was invalidated
+    // since "seenGeneration", as the suggestions may miss the change
+    void insert(const string& prefix, const vector<string>& suggestions, uint64_t seenGeneration, int group = -1,
+        const function<bool(const string&)>& affectedBy = nullptr) {
 		// Do not insert if there is no suggestion
 		if (suggestions.empty()) return;
 
+        Shard& shard = shardOf(prefix);
+        lock_guard<mutex> lock(shard.lock);
+
+        if (generation != seenGeneration) return;
+
+        auto found = shard.index.find(prefix);
+        if (found != shard.index.end()) {
+            EntryIterator entry = found->second.second;
+            entry->suggestions = suggestions;
+            entry->affectedBy = affectedBy;
+
+            // The entry moves to the group of the new suggestions
+            if (entry->group != group) {
+                if (entry->group >= 0) {
+                    auto oldGroup = shard.groups.find(entry->group);
+
+                    oldGroup->second.erase(prefix);
+                    if (oldGroup->second.empty()) shard.groups.erase(oldGroup);
+                }
+
+                entry->group = group;
+                if (group >= 0) shard.groups[group].insert(prefix);
+            }
+
+            return;
+        }
+
+        if (shard.index.size() >= shardCapacity) {
+            BucketIterator lowest = shard.buckets.begin();
+            EntryIterator victim = lowest->entries.begin();
+
+            if (enableLogging) log("[Cache Manager]: Evicted prefix \"" + victim->prefix + "\" with frequency " + to_string(victim->frequency), RED);
+            erase(shard, lowest, victim);
+        }
+
+        if (shard.buckets.empty() || shard.buckets.front().frequency != 1) {
+            shard.buckets.push_front({ 1, {} });
+        }
+
+        BucketIterator bucket = shard.buckets.begin();
         CacheNode node;
+        node.prefix = prefix;
         node.suggestions = suggestions;
         node.frequency = 1;
+        node.group = group;
+        node.affectedBy = affectedBy;
 
-        cache[prefix] = node;
+        bucket->entries.push_back(node);
+        shard.index[prefix] = { bucket, prev(bucket->entries.end()) };
+        if (group >= 0) shard.groups[group].insert(prefix);
         size++;
 
 		if (enableLogging) log("[Cache Manager]: Inserted prefix \"" + prefix + "\" with " + to_string(suggestions.size()) + " suggestions", GREEN);
     }
 
-    // Update the prefix with new suggestions and frequency
-    void update(const string& prefix, const vector<string>& suggestions, bool updateSuggestions = true, bool updateFrequency = true) {
-        if (updateSuggestions) cache[prefix].suggestions = suggestions;
-        if (updateFrequency) cache[prefix].frequency++;
+    void insert(const string& prefix, const vector<string>& suggestions) {
+        insert(prefix, suggestions, generation);
+    }
 
-        if (updateSuggestions) {
-            if (enableLogging) log("[Cache Manager]: Updated suggestions for prefix \"" + prefix + "\"", YELLOW);
-        }
+    void remove(const string& prefix) {
+        generation++;
 
-        if (updateFrequency) {
-            if (enableLogging) log("[Cache Manager]: Updated frequency for prefix \"" + prefix + "\"", YELLOW);
-        }
-    }
+        Shard& shard = shardOf(prefix);
+        lock_guard<mutex> lock(shard.lock);
 
-    // Get the suggestions of a prefix
-    vector<string> get(const string& prefix) {
-        return cache[prefix].suggestions;
-    }
+        auto found = shard.index.find(prefix);
+        if (found == shard.index.end()) return;
 
-    void remove(const string& prefix) {
-        cache.erase(prefix);
-        size--;
+        erase(shard, found->second.first, found->second.second);
 
         if (enableLogging) log("[Cache Manager]: Removed prefix \"" + prefix + "\"", RED);
     }
 
-    // Remove all prefixes whose suggestions contain the word
-    void removeItemByWord(const string& word) {
-        for (auto it = cache.begin(); it != cache.end(); ) {
-            auto& suggestions = it->second.suggestions;
-            auto found = find(suggestions.begin(), suggestions.end(), word);
-
-            if (found != suggestions.end()) {
-                if (enableLogging) log("[Cache Manager]: Removed prefix \"" + it->first + "\"", RED);
+    // Remove the entries affected by a write of the word, looking only at the groups for
+    // which "inGroup" holds. Only the groups holding entries are visited
+    void removeAffected(const function<bool(int)>& inGroup, const string& word) {
+        generation++;
 
-                it = cache.erase(it);
-                size--;
-            }
-            else {
-                it++;
-            }
-        }
-    }
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard->lock);
 
-    // Evict the least frequently used item
-    void evict() {
-        if (size > capacity) {
-            string minFreqPrefix = "";
-            int minFreq = INT_MAX;
+            vector<string> victims;
+            for (const auto& group : shard->groups) {
+                if (!inGroup(group.first)) continue;
 
-            for (auto& item : cache) {
-                if (item.second.frequency < minFreq) {
-                    minFreqPrefix = item.first;
-                    minFreq = item.second.frequency;
+                for (const string& prefix : group.second) {
+                    const CacheNode& entry = *shard->index.at(prefix).second;
+                    if (!entry.affectedBy || entry.affectedBy(word)) victims.push_back(prefix);
                 }
             }
 
-            cache.erase(minFreqPrefix);
-            size--;
+            for (const string& prefix : victims) {
+                auto entry = shard->index.find(prefix);
 
-            if (enableLogging) log("[Cache Manager]: Evicted prefix \"" + minFreqPrefix + "\" with frequency " + to_string(minFreq), RED);
+                if (enableLogging) log("[Cache Manager]: Removed prefix \"" + prefix + "\"", RED);
+                erase(*shard, entry->second.first, entry->second.second);
+            }
         }
     }
 
     void clearCache() {
+        generation++;
+
+        for (auto& shard : shards) {
+            lock_guard<mutex> lock(shard->lock);
+
+            shard->index.clear();
+            shard->buckets.clear();
+            shard->groups.clear();
+        }
         size = 0;
 
         if (enableLogging) log("[Cache Manager]: Cleared cache", RED);
@@ -153,455 +329,6040 @@ public:
 	}
 };
 
+// Index of a missing child. Slot 0 of the first slab is never handed out
+const uint32_t NULL_NODE = 0;
+
+// Portable bit helpers for the child occupancy masks
+inline int popCount(uint32_t x) {
+#ifdef _MSC_VER
+    return (int)__popcnt(x);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+inline int popCount64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    return (int)__popcnt64(x);
+#elif defined(_MSC_VER)
+    return (int)(__popcnt((uint32_t)x) + __popcnt((uint32_t)(x >> 32)));
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+inline int countTrailingZeros(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+inline int countTrailingZeros64(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#elif defined(_MSC_VER)
+    return (uint32_t)x ? countTrailingZeros((uint32_t)x) : 32 + countTrailingZeros((uint32_t)(x >> 32));
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
 // Trie data structure for storing words
 struct TrieNode {
-    TrieNode* children[26];
+    // Bit i is set if the child for 'a' + i exists. The existing children are packed
+    // in alphabetical order into a block of the node pool's child arena, so the child
+    // for a letter sits at the number of set bits below it.
+    uint32_t childMask;
+    uint32_t children;
     bool isEndOfWord;
 
-	TrieNode() : isEndOfWord(false) {
-        for (auto& child : children) child = nullptr;
-    }
+    // Score of the word ending here, and the best score of any word in the subtree
+    uint32_t score;
+    uint32_t maxScore;
+
+	TrieNode() : childMask(0), children(0), isEndOfWord(false), score(0), maxScore(0) {}
 };
 
-class Trie {
+// List of slabs that readers on other threads can index while the owner appends to it.
+// Growing copies the slab pointers into a table twice the size and publishes it, and the
+// old tables stay alive until the directory is cleared as a reader may still be using one
+template <typename T>
+class SlabDirectory {
 private:
-    TrieNode* root;
-    CacheManager* cache;
-	bool enableLogging;
+    vector<unique_ptr<T[]>> slabs;
+    vector<unique_ptr<T*[]>> tables;
+    atomic<T**> table;
+    size_t tableSize;
 
-    bool hasWildcard(const string& word) {
-        return word.find('.') != string::npos || word.find('[') != string::npos;
+public:
+    SlabDirectory() : table(nullptr), tableSize(0) {}
+
+    T* operator[](size_t i) const {
+        return table.load(memory_order_acquire)[i];
     }
 
-    void removeHelper(const string& word, TrieNode*& current, int idx) {
-        if (!current) {
-			return;
-        }
+    size_t size() const {
+        return slabs.size();
+    }
 
-        // If the character reaches the end of word
-        if (idx == word.size()) {
-            if (current->isEndOfWord) {
-                current->isEndOfWord = false;
-            }
+    bool empty() const {
+        return slabs.empty();
+    }
 
-            // If the character is the actual end of word. In case the removing word
-            // is shorter than an existing word, do not delete
-            if (isEmpty(current)) {
-                delete current;
-                current = nullptr;
-            }
+    // Take ownership of a new slab
+    void add(T* slab) {
+        if (slabs.size() == tableSize) {
+            size_t grownSize = max<size_t>(16, tableSize * 2);
+            unique_ptr<T*[]> grown(new T*[grownSize]);
 
-            return;
+            for (size_t i = 0; i < slabs.size(); i++) grown[i] = slabs[i].get();
+
+            tables.push_back(move(grown));
+            table.store(tables.back().get(), memory_order_release);
+            tableSize = grownSize;
         }
 
-        int i = word[idx] - 'a';
+        table.load(memory_order_relaxed)[slabs.size()] = slab;
+        slabs.emplace_back(slab);
+    }
 
-        // Recursively iterate every character of the word
-        removeHelper(word, current->children[i], idx + 1);
+    // Move every slab of the other directory to the end of this one
+    void append(SlabDirectory& other) {
+        for (auto& slab : other.slabs) add(slab.release());
+        other.clear();
+    }
 
-        // If the current character has not child (or its child was removed earlier)
-        // and it is not the end of another word (this is the case which the removing word
-        // is longer than an existing word)
-        if (isEmpty(current) && !current->isEndOfWord) {
-            delete current;
-            current = nullptr;
-        }
+    void clear() {
+        slabs.clear();
+        tables.clear();
+        table.store(nullptr, memory_order_release);
+        tableSize = 0;
     }
+};
 
-    void suggestHelper(vector<string>& results, TrieNode* currentNode, string currentWord, int wordLimit) {
-        comparisons++;
-        if (!currentNode || results.size() >= wordLimit) {
-            return;
-        }
+// Pool of trie nodes stored in large contiguous slabs. A node is addressed by its
+// index: the high bits select the slab and the low bits the position inside it.
+// Slabs never move once allocated, so a TrieNode* stays valid until the pool is reset.
+class NodePool {
+private:
+    static const uint32_t SLAB_SHIFT = 12;
+    static const uint32_t SLAB_SIZE = 1 << SLAB_SHIFT;
+
+    // The child arena hands out blocks of 1, 2, 4, 8, 16 or 32 slots
+    static const uint32_t ARENA_SHIFT = 14;
+    static const uint32_t ARENA_SLAB_SIZE = 1 << ARENA_SHIFT;
+    static const int BLOCK_CLASSES = 6;
+
+    SlabDirectory<TrieNode> slabs;
+    uint32_t nextIndex;
+    uint32_t freeList;
+    size_t liveNodes;
+
+    SlabDirectory<uint32_t> arenaSlabs;
+    uint32_t nextSlot;
+    uint32_t freeBlocks[BLOCK_CLASSES];
+
+    // Last entries of the free lists, only set by rebase() so adopt() can splice the lists
+    uint32_t freeListTail;
+    uint32_t freeBlockTails[BLOCK_CLASSES];
+
+    // Size class of the block that holds "count" children
+    static int blockClass(int count) {
+        int sizeClass = 0;
+        while ((1 << sizeClass) < count) sizeClass++;
+        return sizeClass;
+    }
 
-        // If the character is the end of an existing word, add it to the list
-        comparisons++;
-        if (currentNode->isEndOfWord) {
-            results.push_back(currentWord);
-        }
+    uint32_t allocateBlock(int sizeClass) {
+        uint32_t blockSize = 1 << sizeClass;
+        uint32_t block;
 
-        // Explore all possible continuations
-        for (int i = 0; i < 26; i++) {
-			comparisons++;
-            
-            comparisons++;
-            if (currentNode->children[i]) {
-                // Append a character to make a new word
-                currentWord.push_back('a' + i);
-                suggestHelper(results, currentNode->children[i], currentWord, wordLimit);
-                currentWord.pop_back();
+        // Free blocks of a class are linked through their first slot, offset by one
+        // so that 0 can mark the end of the list
+        if (freeBlocks[sizeClass] != 0) {
+            block = freeBlocks[sizeClass] - 1;
+            freeBlocks[sizeClass] = *slot(block);
+        }
+        else {
+            // A block never straddles two arena slabs, the tail of a full slab is skipped
+            uint32_t offset = nextSlot & (ARENA_SLAB_SIZE - 1);
+            if ((nextSlot >> ARENA_SHIFT) == arenaSlabs.size() || offset + blockSize > ARENA_SLAB_SIZE) {
+                nextSlot = (uint32_t)arenaSlabs.size() << ARENA_SHIFT;
+                arenaSlabs.add(new uint32_t[ARENA_SLAB_SIZE]);
             }
+
+            block = nextSlot;
+            nextSlot += blockSize;
         }
-        comparisons++;
+
+        return block;
+    }
+
+    void releaseBlock(uint32_t block, int sizeClass) {
+        *slot(block) = freeBlocks[sizeClass];
+        freeBlocks[sizeClass] = block + 1;
+    }
+
+public:
+    NodePool() : nextIndex(1), freeList(NULL_NODE), liveNodes(0), nextSlot(0), freeListTail(NULL_NODE) {
+        for (auto& head : freeBlocks) head = 0;
+        for (auto& tail : freeBlockTails) tail = 0;
     }
 
-    void searchByRegex(vector<string>& results, string targetWord, TrieNode* currentNode, string currentWord, int& wordLimit) {
-        if (!currentNode || results.size() >= wordLimit) return;
+    TrieNode* get(uint32_t index) {
+        return &slabs[index >> SLAB_SHIFT][index & (SLAB_SIZE - 1)];
+    }
 
-        // Iterate through every character of the target word
-        for (int i = 0; i < targetWord.size(); i++) {
-            char c = targetWord[i];
+    uint32_t* slot(uint32_t position) {
+        return &arenaSlabs[position >> ARENA_SHIFT][position & (ARENA_SLAB_SIZE - 1)];
+    }
 
-            // If the character is a wildcard, recursively search all possible continuations
-            if (c == '.') {
-                string sub = targetWord.substr(i + 1);
+    size_t size() {
+        return liveNodes;
+    }
 
-                for (int j = 0; j < 26; j++) {
-                    if (currentNode->children[j]) {
-                        currentWord.push_back('a' + j);
-                        searchByRegex(results, sub, currentNode->children[j], currentWord, wordLimit);
-                        currentWord.pop_back(); // Backtrack
-                    }
-                }
+    size_t capacity() {
+        return slabs.size() * SLAB_SIZE;
+    }
 
-                // If the character is a wildcard, the search is done since all possible continuations are explored
-                // and there is no need to continue searching for the next character in the target word.
-                return;
+    // Bytes held by the node slabs and the child arena
+    size_t memoryUsage() {
+        return slabs.size() * SLAB_SIZE * sizeof(TrieNode) + arenaSlabs.size() * ARENA_SLAB_SIZE * sizeof(uint32_t);
+    }
 
-            }
-            else if (c == '[') {
-                // If the character is a bracket, find the closing bracket
-                bool exclude = false;
-                int j = i + 1;
+    uint32_t allocate() {
+        uint32_t index;
 
-                // If the circumflex is not found, the target word is invalid
-                if (j == targetWord.size()) {
-                    if (enableLogging) log("[Trie]: Invalid regex: " + targetWord, RED);
-                    return;
-                }
+        // Reuse a released node first. Free nodes are linked through their children field
+        if (freeList != NULL_NODE) {
+            index = freeList;
+            freeList = get(index)->children;
+        }
+        else {
+            if ((nextIndex >> SLAB_SHIFT) == slabs.size()) {
+                slabs.add(new TrieNode[SLAB_SIZE]);
+            }
 
-                // If the first character inside the bracket is the circumflex, exclude the characters inside the bracket
-                if (targetWord[j] == '^') {
-                    exclude = true;
-                    j++;
-                }
+            index = nextIndex++;
+        }
 
-                // Find the closing bracket
-                while (j < targetWord.size() && targetWord[j] != ']') j++;
+        *get(index) = TrieNode();
+        liveNodes++;
 
-                // If the closing bracket is not found, the target word is invalid
-                if (j == targetWord.size()) {
-                    if (enableLogging) log("[Trie]: Invalid regex: " + targetWord, RED);
-                    return;
-                }
+        return index;
+    }
 
-                // Extract the characters inside the bracket
-                string sub = exclude ? targetWord.substr(i + 2, j - i - 2) : targetWord.substr(i + 1, j - i - 1);
-
-                if (exclude) {
-                    for (int k = 0; k < 26; k++) {
-                        // If the character is not in the exclusion list and the child exists, search it
-                        if (sub.find('a' + k) == string::npos && currentNode->children[k]) {
-                            currentWord.push_back('a' + k);
-                            searchByRegex(results, targetWord.substr(j + 1), currentNode->children[k], currentWord, wordLimit);
-                            currentWord.pop_back();
-                        }
-                    }
-                }
-                else {
-                    for (char c : sub) {
-                        // If the character is in the inclusion list and the child exists, search it
-                        if (currentNode->children[c - 'a']) {
-                            currentWord.push_back(c);
-                            searchByRegex(results, targetWord.substr(j + 1), currentNode->children[c - 'a'], currentWord, wordLimit);
-                            currentWord.pop_back();
-                        }
-                    }
-                }
+    void release(uint32_t index) {
+        TrieNode* node = get(index);
 
-                // The return is the same as the wildcard case
-                return;
+        if (node->childMask) releaseBlock(node->children, blockClass(popCount(node->childMask)));
 
-                // Otherwise, search the trie as usual
-            }
-            else {
-                if (!currentNode->children[c - 'a']) return;
+        node->childMask = 0;
+        node->children = freeList;
+        freeList = index;
+        liveNodes--;
+    }
 
-                currentWord.push_back(c);
-                currentNode = currentNode->children[c - 'a'];
-            }
-        }
+    uint32_t getChild(TrieNode* node, int i) {
+        uint32_t bit = 1u << i;
+        if (!(node->childMask & bit)) return NULL_NODE;
 
-        // If the character is the end of an existing word, which means the target word is found
-        // with the same length as the word in the trie, add it to the list
-        if (currentNode->isEndOfWord) {
-            results.push_back(currentWord);
-        }
+        // The rank of the bit among the set bits is the position in the packed array
+        return *slot(node->children + popCount(node->childMask & (bit - 1)));
     }
 
-    void fuzzySearchHelper(TrieNode* node, string& query, int maxDistance,
-        const vector<int>& previousRow, string currentWord, vector<pair<string, int>>& results) {
+    void addChild(TrieNode* node, int i, uint32_t child) {
+        uint32_t bit = 1u << i;
+        int count = popCount(node->childMask);
+        int rank = popCount(node->childMask & (bit - 1));
 
-        char nodeChar = currentWord.back();
-        int numCols = query.size() + 1;
-        vector<int> currentRow(numCols);
+        // Move to a bigger block when the current one is full
+        if (count == 0 || blockClass(count + 1) != blockClass(count)) {
+            uint32_t block = allocateBlock(blockClass(count + 1));
 
-        // Update DP table for this character
+            for (int k = 0; k < rank; k++) *slot(block + k) = *slot(node->children + k);
+            for (int k = rank; k < count; k++) *slot(block + k + 1) = *slot(node->children + k);
 
-        // The first entry in the current row is always the previous row's first entry + 1.
-        // Think of a 2D matrix where the first row is the query and the first column is the word. 
-        // Each cell represents the minimum number of operations to convert the prefix of the word to the prefix of the query.
-        currentRow[0] = previousRow[0] + 1;
+            if (count) releaseBlock(node->children, blockClass(count));
+            node->children = block;
+        }
+        else {
+            for (int k = count; k > rank; k--) *slot(node->children + k) = *slot(node->children + k - 1);
+        }
 
-        // Assume that "i" is character index in the query string, and "j" is character index in the node string
-        // "w1" is the query string, "w2" is the node string.
-        // We start from (1,1) since (0,0) is already initialized (considering empty string).
-        for (int col = 1; col < numCols; col++) {
-            // In the insertion case, we try to insert a character at w2[j] to match w1[i-1] (which is just before the current character of w1)
-            // This makes the character at w2[j] equal to w1[i-1], so we can shift i-1 to i and it costs 1 operation.
-            int insertCost = currentRow[col - 1] + 1;
+        *slot(node->children + rank) = child;
+        node->childMask |= bit;
+    }
 
-            // In the deletion case, we try to delete a character at w1[i] and shift to w1[i+1] to match w2[j].
-            // Similar to the insertion case, we shift i to i+1 and it costs 1 operation.
-            int deleteCost = previousRow[col] + 1;
+    void removeChild(TrieNode* node, int i) {
+        uint32_t bit = 1u << i;
+        if (!(node->childMask & bit)) return;
 
-            // In the replacement case, we try to replace the character at w2[j] with w1[i] to make them equal.
-            // If two characters are already equal, it costs 0 operation. Otherwise, it costs 1 operation.
-            int replaceCost = previousRow[col - 1] + (query[col - 1] != nodeChar ? 1 : 0);
+        int count = popCount(node->childMask);
+        int rank = popCount(node->childMask & (bit - 1));
 
-            // Final cost is the minimum of the three operations
-            currentRow[col] = min({ insertCost, deleteCost, replaceCost });
-        }
+        for (int k = rank; k + 1 < count; k++) *slot(node->children + k) = *slot(node->children + k + 1);
+        node->childMask &= ~bit;
 
-        // If the last entry in the current row is within maxDistance and the node is a word, add it to the list
-        if (currentRow.back() <= maxDistance && node->isEndOfWord) {
-            results.push_back({ currentWord, currentRow.back() });
+        // Shrink to the smaller block once the children fit into it
+        if (count == 1) {
+            releaseBlock(node->children, 0);
+            node->children = 0;
         }
+        else if (blockClass(count - 1) != blockClass(count)) {
+            uint32_t block = allocateBlock(blockClass(count - 1));
 
-        // Prune paths where the minimum edit distance exceeds maxDistance
-        if (*min_element(currentRow.begin(), currentRow.end()) > maxDistance) {
-            return;
-        }
+            for (int k = 0; k < count - 1; k++) *slot(block + k) = *slot(node->children + k);
 
-        // Recurse to children
-        for (int i = 0; i < 26; ++i) {
-            if (node->children[i]) {
-                currentWord.push_back('a' + i);
-                fuzzySearchHelper(node->children[i], query, maxDistance, currentRow, currentWord, results);
-                currentWord.pop_back();
-            }
+            releaseBlock(node->children, blockClass(count));
+            node->children = block;
         }
     }
 
-    void clearTrie(TrieNode* &node) {
-        if (!node) return;
+    // Replace an existing child
+    void setChild(TrieNode* node, int i, uint32_t child) {
+        *slot(node->children + popCount(node->childMask & ((1u << i) - 1))) = child;
+    }
+
+    // Copy of a node with a child block of its own, so the copy can be changed while
+    // the original is still being read
+    uint32_t clone(uint32_t index) {
+        uint32_t copy = allocate();
+        TrieNode* source = get(index);
+        TrieNode* target = get(copy);
+        int count = popCount(source->childMask);
 
-        for (int i = 0; i < 26; i++) {
-            if (node->children[i]) {
-                clearTrie(node->children[i]);
-            }
+        *target = *source;
+
+        if (count) {
+            target->children = allocateBlock(blockClass(count));
+            for (int k = 0; k < count; k++) *slot(target->children + k) = *slot(source->children + k);
         }
 
-        delete node;
-        node = nullptr;
+        return copy;
     }
-public:
-    int comparisons;
 
-    Trie() : comparisons(0), enableLogging(true) {
-        root = new TrieNode();
-        cache = new CacheManager(10);
+    size_t slabCount() {
+        return slabs.size();
     }
 
-    void setLogging(bool enable) {
-		enableLogging = enable;
-		cache->setLogging(enable);
+    size_t arenaSlabCount() {
+        return arenaSlabs.size();
     }
 
-    void loadDictionary(const string& filename) {
-        ifstream ifile(filename);
-        string word;
+    // Shift every node index and child slot as if the slabs of this pool came after
+    // "nodeSlabs" node slabs and "slotSlabs" arena slabs of another pool, which then adopts
+    // it. Nothing else may be called in between. Returns the offset added to node indices
+    uint32_t rebase(size_t nodeSlabs, size_t slotSlabs) {
+        uint32_t nodeOffset = (uint32_t)nodeSlabs << SLAB_SHIFT;
+        uint32_t slotOffset = (uint32_t)slotSlabs << ARENA_SHIFT;
 
-        if (!ifile.is_open()) {
-			if (enableLogging) log("[Trie]: Error opening file", RED);
-            return;
+        for (uint32_t index = 1; index < nextIndex; index++) {
+            TrieNode* node = get(index);
+            if (!node->childMask) continue;
+
+            uint32_t* children = slot(node->children);
+            for (int k = popCount(node->childMask) - 1; k >= 0; k--) children[k] += nodeOffset;
+
+            node->children += slotOffset;
         }
 
-        if (enableLogging) log("Loading dictionary...", YELLOW);
-        while (getline(ifile, word)) {
-            // Assume that the word has no leading and trailing spaces
-            if (word.empty()) continue;
+        // Free nodes have no children and are linked through their children field
+        freeListTail = NULL_NODE;
+        for (uint32_t index = freeList; index != NULL_NODE;) {
+            TrieNode* node = get(index);
 
-            insert(word);
+            freeListTail = index + nodeOffset;
+            index = node->children;
+            if (index != NULL_NODE) node->children += nodeOffset;
         }
+        if (freeList != NULL_NODE) freeList += nodeOffset;
 
-        if (enableLogging) log("[Trie]: Dictionary loaded successfully", GREEN);
+        for (int sizeClass = 0; sizeClass < BLOCK_CLASSES; sizeClass++) {
+            freeBlockTails[sizeClass] = 0;
 
-        ifile.close();
-    }
+            for (uint32_t block = freeBlocks[sizeClass]; block != 0;) {
+                uint32_t* link = slot(block - 1);
 
-    bool isEmpty(TrieNode* current) {
-        for (int i = 0; i < 26; i++) {
-            if (current->children[i]) return false;
+                freeBlockTails[sizeClass] = block + slotOffset;
+                block = *link;
+                if (block != 0) *link += slotOffset;
+            }
+            if (freeBlocks[sizeClass] != 0) freeBlocks[sizeClass] += slotOffset;
         }
 
-        return true;
-    }
+        nextIndex += nodeOffset;
+        nextSlot += slotOffset;
 
-    void insert(const string& word) {
-        TrieNode* current = root;
+        return nodeOffset;
+    }
 
-        for (char c : word) {
-            int idx = c - 'a';
+    // Take over the slabs of a pool that was rebased onto this one, leaving it empty. The
+    // unused ends of the current last slabs go to the free lists, as allocation continues
+    // after the adopted slabs
+    void adopt(NodePool& other) {
+        if (other.slabs.empty()) return;
 
-            if (!current->children[idx]) {
-                current->children[idx] = new TrieNode();
-            }
+        for (uint32_t index = nextIndex; (index >> SLAB_SHIFT) < slabs.size(); index++) {
+            TrieNode* node = get(index);
 
-            current = current->children[idx];
+            node->childMask = 0;
+            node->children = freeList;
+            freeList = index;
         }
 
-        current->isEndOfWord = true;
+        if ((nextSlot >> ARENA_SHIFT) < arenaSlabs.size()) {
+            uint32_t remaining = ARENA_SLAB_SIZE - (nextSlot & (ARENA_SLAB_SIZE - 1));
 
-        // Update the cache by removing all prefixes whose suggestions contain the inserted word.
-        // This is more efficient because the prefix will only be updated when it is searched again.
-        // So there is no need to update all the cache immediately after inserting the word.
-        cache->removeItemByWord(word);
+            while (remaining > 0) {
+                int sizeClass = BLOCK_CLASSES - 1;
+                while ((1u << sizeClass) > remaining) sizeClass--;
 
-        //log("Inserted word " + word, GREEN);
-    }
+                releaseBlock(nextSlot, sizeClass);
+                nextSlot += 1 << sizeClass;
+                remaining -= 1 << sizeClass;
+            }
+        }
 
-    TrieNode* searchPrefix(const string& word) {
-        TrieNode* current = root;
+        slabs.append(other.slabs);
+        arenaSlabs.append(other.arenaSlabs);
 
-        for (auto& c : word) {
-			comparisons++;
-            // If the word being searched is longer than an existing word
-            comparisons++;
-            if (!current->children[c - 'a']) {
-                return nullptr;
-            }
+        nextIndex = other.nextIndex;
+        nextSlot = other.nextSlot;
+        liveNodes += other.liveNodes;
 
-            current = current->children[c - 'a'];
+        // Put the free lists of the other pool in front of ours
+        if (other.freeList != NULL_NODE) {
+            get(other.freeListTail)->children = freeList;
+            freeList = other.freeList;
         }
-		comparisons++;
 
-        // If the word being searched exists in trie, there is no need to traverse further
+        for (int sizeClass = 0; sizeClass < BLOCK_CLASSES; sizeClass++) {
+            if (other.freeBlocks[sizeClass] == 0) continue;
+
+            *slot(other.freeBlockTails[sizeClass] - 1) = freeBlocks[sizeClass];
+            freeBlocks[sizeClass] = other.freeBlocks[sizeClass];
+        }
+
+        other.reset();
+    }
+
+    // Drop every slab at once instead of freeing the nodes one by one
+    void reset() {
+        slabs.clear();
+        nextIndex = 1;
+        freeList = NULL_NODE;
+        liveNodes = 0;
+
+        arenaSlabs.clear();
+        nextSlot = 0;
+        for (auto& head : freeBlocks) head = 0;
+    }
+};
+
+// Characters that make a query a regex instead of a prefix
+const char* const REGEX_OPERATORS = ".[*+?|()^$";
+
+// Regex over lowercase words, compiled once into a Thompson NFA whose state sets are turned
+// into DFA states as a search reaches them. A word matches if the whole word matches, so
+// "^" and "$" are implied at both ends and only matter inside the pattern. Supported are
+// letters, ".", "[...]", "[^...]", "*", "+", "?", "|", "(...)", "^" and "$".
+// Every DFA state knows the letters it can go on with, so a search only descends into the
+// children in that mask, and stops where no state is left
+class RegexAutomaton {
+public:
+    static const int DEAD = -1;
+
+private:
+    enum NfaType { NFA_LETTERS, NFA_EPSILON, NFA_SPLIT, NFA_START_ANCHOR, NFA_END_ANCHOR, NFA_MATCH };
+
+    struct NfaState {
+        NfaType type;
+        uint32_t mask;
+        int out;
+        int out1;
+    };
+
+    // Part of the NFA being built. Exits are the edges still to connect, as 2 * state + edge
+    struct Fragment {
+        int start;
+        vector<int> exits;
+        int minLength;
+
+        // -1 if unbounded
+        int maxLength;
+    };
+
+    struct DfaState {
+        // NFA states reading a letter, sorted
+        vector<int> nfaStates;
+        bool accepting;
+        uint32_t letters;
+
+        // Next DFA state for each letter, UNKNOWN until first taken
+        int next[26];
+    };
+
+    static const int UNKNOWN = -2;
+
+    vector<NfaState> nfa;
+    vector<DfaState> dfa;
+    map<pair<vector<int>, bool>, int> dfaIndex;
+    int startState;
+    int length;
+
+    // Parser state. Every open parenthesis is a level of recursion of the parser
+    string pattern;
+    size_t pos;
+    int nesting;
+    bool error;
+
+    int addState(NfaType type, uint32_t mask = 0, int out = -1, int out1 = -1) {
+        nfa.push_back({ type, mask, out, out1 });
+        return (int)nfa.size() - 1;
+    }
+
+    void connect(const vector<int>& exits, int target) {
+        for (int exit : exits) {
+            if (exit % 2 == 0) nfa[exit / 2].out = target;
+            else nfa[exit / 2].out1 = target;
+        }
+    }
+
+    Fragment single(NfaType type, uint32_t mask, int length) {
+        int state = addState(type, mask);
+        return { state, { 2 * state }, length, length };
+    }
+
+    Fragment parseAlternation() {
+        Fragment left = parseConcatenation();
+
+        while (!error && pos < pattern.size() && pattern[pos] == '|') {
+            pos++;
+            Fragment right = parseConcatenation();
+
+            left.start = addState(NFA_SPLIT, 0, left.start, right.start);
+            left.exits.insert(left.exits.end(), right.exits.begin(), right.exits.end());
+            left.minLength = min(left.minLength, right.minLength);
+            left.maxLength = left.maxLength < 0 || right.maxLength < 0 ? -1 : max(left.maxLength, right.maxLength);
+        }
+
+        return left;
+    }
+
+    Fragment parseConcatenation() {
+        Fragment result = single(NFA_EPSILON, 0, 0);
+
+        while (!error && pos < pattern.size() && pattern[pos] != '|' && pattern[pos] != ')') {
+            Fragment next = parseRepeat();
+
+            connect(result.exits, next.start);
+            result.exits = next.exits;
+            result.minLength += next.minLength;
+            result.maxLength = result.maxLength < 0 || next.maxLength < 0 ? -1 : result.maxLength + next.maxLength;
+        }
+
+        return result;
+    }
+
+    Fragment parseRepeat() {
+        Fragment atom = parseAtom();
+
+        while (!error && pos < pattern.size() && (pattern[pos] == '*' || pattern[pos] == '+' || pattern[pos] == '?')) {
+            char op = pattern[pos++];
+            int split = addState(NFA_SPLIT, 0, atom.start);
+
+            if (op == '*') {
+                connect(atom.exits, split);
+                atom = { split, { 2 * split + 1 }, 0, -1 };
+            }
+            else if (op == '+') {
+                connect(atom.exits, split);
+                atom = { atom.start, { 2 * split + 1 }, atom.minLength, -1 };
+            }
+            else {
+                atom.exits.push_back(2 * split + 1);
+                atom = { split, atom.exits, 0, atom.maxLength };
+            }
+        }
+
+        return atom;
+    }
+
+    Fragment parseAtom() {
+        const uint32_t ALL_LETTERS = (1u << 26) - 1;
+        char c = pattern[pos++];
+
+        if (c == '(') {
+            if (++nesting > MAX_NESTING) {
+                error = true;
+                return single(NFA_EPSILON, 0, 0);
+            }
+
+            Fragment inner = parseAlternation();
+            nesting--;
+
+            if (pos == pattern.size() || pattern[pos] != ')') error = true;
+            pos++;
+            return inner;
+        }
+        if (c == '[') {
+            bool exclude = false;
+            uint32_t mask = 0;
+
+            if (pos < pattern.size() && pattern[pos] == '^') {
+                exclude = true;
+                pos++;
+            }
+
+            while (pos < pattern.size() && pattern[pos] != ']') {
+                if (pattern[pos] >= 'a' && pattern[pos] <= 'z') mask |= 1u << (pattern[pos] - 'a');
+                pos++;
+            }
+
+            if (pos == pattern.size()) error = true;
+            pos++;
+            return single(NFA_LETTERS, exclude ? ALL_LETTERS & ~mask : mask, 1);
+        }
+        if (c == '.') return single(NFA_LETTERS, ALL_LETTERS, 1);
+        if (c == '^') return single(NFA_START_ANCHOR, 0, 0);
+        if (c == '$') return single(NFA_END_ANCHOR, 0, 0);
+
+        // A quantifier with nothing to repeat
+        if (c == '*' || c == '+' || c == '?') error = true;
+
+        return single(NFA_LETTERS, c >= 'a' && c <= 'z' ? 1u << (c - 'a') : 0, 1);
+    }
+
+    // Add the NFA states reachable from "state" without reading a letter. States after a "$"
+    // may only lead to the match, and a "^" is only passed before the first letter
+    void closure(int from, bool atStart, vector<int>& letterStates, bool& accepting, vector<char>& seen) {
+        // States left to visit, with whether a "$" was passed on the way. A chain of
+        // quantifiers is as long as the pattern, so it is walked without recursion
+        vector<pair<int, bool>> pending = { { from, false } };
+
+        while (!pending.empty()) {
+            int state = pending.back().first;
+            bool ended = pending.back().second;
+            pending.pop_back();
+
+            if (state < 0 || seen[2 * state + ended]) continue;
+            seen[2 * state + ended] = 1;
+
+            const NfaState& current = nfa[state];
+
+            switch (current.type) {
+            case NFA_LETTERS:
+                if (!ended && current.mask) letterStates.push_back(state);
+                break;
+            case NFA_EPSILON:
+                pending.push_back({ current.out, ended });
+                break;
+            case NFA_SPLIT:
+                pending.push_back({ current.out1, ended });
+                pending.push_back({ current.out, ended });
+                break;
+            case NFA_START_ANCHOR:
+                if (atStart) pending.push_back({ current.out, ended });
+                break;
+            case NFA_END_ANCHOR:
+                pending.push_back({ current.out, true });
+                break;
+            case NFA_MATCH:
+                accepting = true;
+                break;
+            }
+        }
+    }
+
+    // DFA state of the closure of the given NFA states, DEAD if nothing is left
+    int intern(const vector<int>& states, bool atStart) {
+        vector<char> seen(2 * nfa.size(), 0);
+        vector<int> letterStates;
+        bool accepting = false;
+
+        for (int state : states) closure(state, atStart, letterStates, accepting, seen);
+        if (letterStates.empty() && !accepting) return DEAD;
+
+        sort(letterStates.begin(), letterStates.end());
+
+        auto key = make_pair(letterStates, accepting);
+        auto found = dfaIndex.find(key);
+        if (found != dfaIndex.end()) return found->second;
+
+        DfaState state;
+        state.nfaStates = letterStates;
+        state.accepting = accepting;
+        state.letters = 0;
+        for (int nfaState : letterStates) state.letters |= nfa[nfaState].mask;
+        fill(state.next, state.next + 26, UNKNOWN);
+
+        dfa.push_back(state);
+        dfaIndex[key] = (int)dfa.size() - 1;
+
+        return (int)dfa.size() - 1;
+    }
+
+public:
+    // Deepest nesting of parentheses compile() accepts
+    static const int MAX_NESTING = 256;
+
+    RegexAutomaton() : startState(DEAD), length(-1), pos(0), nesting(0), error(false) {}
+
+    // Returns false if the pattern is invalid: an unclosed "[" or "(", a stray ")", a
+    // quantifier with nothing to repeat or parentheses nested deeper than MAX_NESTING
+    bool compile(const string& source) {
+        nfa.clear();
+        dfa.clear();
+        dfaIndex.clear();
+        pattern = source;
+        pos = 0;
+        nesting = 0;
+        error = false;
+
+        Fragment whole = parseAlternation();
+        if (pos < pattern.size()) error = true;
+
+        if (error) {
+            startState = DEAD;
+            return false;
+        }
+
+        connect(whole.exits, addState(NFA_MATCH));
+        length = whole.minLength == whole.maxLength ? whole.minLength : -1;
+        startState = intern({ whole.start }, true);
+
+        return true;
+    }
+
+    int start() const {
+        return startState;
+    }
+
+    // Letters that may follow in the state. A letter outside the mask leads to DEAD
+    uint32_t letters(int state) const {
+        return dfa[state].letters;
+    }
+
+    bool accepting(int state) const {
+        return dfa[state].accepting;
+    }
+
+    int step(int state, char c) {
+        int letter = c - 'a';
+        if (letter < 0 || letter >= 26 || !(dfa[state].letters & (1u << letter))) return DEAD;
+
+        if (dfa[state].next[letter] == UNKNOWN) {
+            vector<int> targets;
+
+            for (int nfaState : dfa[state].nfaStates) {
+                if (nfa[nfaState].mask & (1u << letter)) targets.push_back(nfa[nfaState].out);
+            }
+
+            int next = intern(targets, false);
+            dfa[state].next[letter] = next;
+        }
+
+        return dfa[state].next[letter];
+    }
+
+    // Length of every matching word, or -1 if matching words can differ in length
+    int fixedLength() const {
+        return length;
+    }
+
+    bool matches(const string& word) {
+        int state = startState;
+
+        for (char c : word) {
+            if (state == DEAD) return false;
+            state = step(state, c);
+        }
+
+        return state != DEAD && accepting(state);
+    }
+};
+
+const int RegexAutomaton::DEAD;
+const int RegexAutomaton::UNKNOWN;
+
+// Compute the next row of the Levenshtein DP table after appending "c" to the word,
+// see Trie::fuzzySearchHelper for the meaning of each cost. Returns the row minimum.
+// Both rows hold query.size() + 1 cells.
+int computeEditRow(const string& query, const int* previousRow, char c, int* currentRow) {
+    int numCols = query.size() + 1;
+
+    currentRow[0] = previousRow[0] + 1;
+    int rowMin = currentRow[0];
+
+    for (int col = 1; col < numCols; col++) {
+        int insertCost = currentRow[col - 1] + 1;
+        int deleteCost = previousRow[col] + 1;
+        int replaceCost = previousRow[col - 1] + (query[col - 1] != c ? 1 : 0);
+
+        currentRow[col] = min({ insertCost, deleteCost, replaceCost });
+        rowMin = min(rowMin, currentRow[col]);
+    }
+
+    return rowMin;
+}
+
+int computeEditRow(const string& query, const vector<int>& previousRow, char c, vector<int>& currentRow) {
+    currentRow.resize(query.size() + 1);
+    return computeEditRow(query, previousRow.data(), c, currentRow.data());
+}
+
+// Levenshtein distance between two words. With transpositions, swapping two adjacent letters
+// also counts as one edit (optimal string alignment distance)
+int editDistance(const string& a, const string& b, bool transpositions = false) {
+    if (!transpositions) {
+        vector<int> previousRow(a.size() + 1), currentRow;
+
+        for (size_t i = 0; i <= a.size(); i++) previousRow[i] = i;
+
+        for (char c : b) {
+            computeEditRow(a, previousRow, c, currentRow);
+            swap(previousRow, currentRow);
+        }
+
+        return previousRow.back();
+    }
+
+    vector<vector<int>> table(b.size() + 1, vector<int>(a.size() + 1));
+
+    for (size_t i = 0; i <= b.size(); i++) {
+        for (size_t j = 0; j <= a.size(); j++) {
+            if (i == 0 || j == 0) {
+                table[i][j] = i + j;
+                continue;
+            }
+
+            table[i][j] = min({ table[i - 1][j] + 1, table[i][j - 1] + 1, table[i - 1][j - 1] + (b[i - 1] != a[j - 1] ? 1 : 0) });
+
+            if (i > 1 && j > 1 && b[i - 1] == a[j - 2] && b[i - 2] == a[j - 1]) {
+                table[i][j] = min(table[i][j], table[i - 2][j - 2] + 1);
+            }
+        }
+    }
+
+    return table[b.size()][a.size()];
+}
+
+// Bit-parallel edit distance of Myers and Hyyro between a query and a word read one letter
+// at a time. A column of the DP table is kept as the vertical differences between its
+// cells, one bit per query letter in 64-bit blocks (VP for +1, VN for -1), so reading a
+// letter takes a few word operations per block instead of a pass over the query.
+// With transpositions the distance is the optimal string alignment (Damerau) distance.
+// A column is stored by the caller as VP, VN and D0 (the diagonal zero bits), "stride"
+// words in all, so a search keeps one buffer for the whole path and allocates nothing
+class EditDistanceKernel {
+private:
+    int length;
+    int blockCount;
+    bool transpositions;
+
+    // Bits of the query positions holding each letter
+    vector<uint64_t> letterMasks;
+
+    const uint64_t* matches(char c) const {
+        return &letterMasks[(c - 'a') * blockCount];
+    }
+
+    static bool bit(const uint64_t* vector, int i) {
+        return (vector[i / 64] >> (i % 64)) & 1;
+    }
+
+public:
+    EditDistanceKernel(const string& query, bool transpositions = false)
+        : length(query.size()), blockCount(max(1, ((int)query.size() + 63) / 64)), transpositions(transpositions), letterMasks(26 * blockCount, 0) {
+
+        for (int i = 0; i < length; i++) {
+            if (query[i] >= 'a' && query[i] <= 'z') letterMasks[(query[i] - 'a') * blockCount + i / 64] |= 1ull << (i % 64);
+        }
+    }
+
+    int stride() const {
+        return 3 * blockCount;
+    }
+
+    // Column of the empty word, where the distance to the first i query letters is i
+    void init(uint64_t* column) const {
+        for (int b = 0; b < blockCount; b++) {
+            column[b] = ~0ull;
+            column[blockCount + b] = 0;
+            column[2 * blockCount + b] = 0;
+        }
+    }
+
+    // Read letter c after "previous", whose last letter was "last" (0 for the empty word),
+    // into "next". Returns the distance between the query and the word read so far
+    int step(const uint64_t* previous, char last, char c, uint64_t* next, int distance) const {
+        if (length == 0) return distance + 1;
+
+        const uint64_t* eq = matches(c);
+        const uint64_t* lastEq = last ? matches(last) : nullptr;
+
+        uint64_t addCarry = 0, hpCarry = 1, hnCarry = 0, trCarry = 0;
+        int top = (length - 1) / 64;
+        uint64_t topBit = 1ull << ((length - 1) % 64);
+
+        for (int b = 0; b < blockCount; b++) {
+            uint64_t vp = previous[b], vn = previous[blockCount + b];
+            uint64_t x = eq[b] & vp;
+
+            uint64_t sum = x + vp;
+            uint64_t carry = sum < x;
+            sum += addCarry;
+            addCarry = carry | (sum < addCarry);
+
+            uint64_t d0 = (sum ^ vp) | eq[b] | vn;
+
+            // A transposition lets the diagonal of two letters back continue
+            if (transpositions && lastEq) {
+                uint64_t moved = ~previous[2 * blockCount + b] & eq[b];
+                d0 |= ((moved << 1) | trCarry) & lastEq[b];
+                trCarry = moved >> 63;
+            }
+
+            uint64_t hp = vn | ~(d0 | vp);
+            uint64_t hn = vp & d0;
+
+            if (b == top) {
+                if (hp & topBit) distance++;
+                else if (hn & topBit) distance--;
+            }
+
+            uint64_t hpShift = (hp << 1) | hpCarry;
+            uint64_t hnShift = (hn << 1) | hnCarry;
+            hpCarry = hp >> 63;
+            hnCarry = hn >> 63;
+
+            next[b] = hnShift | ~(hpShift | d0);
+            next[blockCount + b] = hpShift & d0;
+            next[2 * blockCount + b] = d0;
+        }
+
+        return distance;
+    }
+
+    // True if a longer word could still be within maxDistance, that is if some cell of the
+    // column of a word of "wordLength" letters is. Only the cells at most maxDistance away
+    // from the diagonal are looked at, the others are further than that anyway
+    bool withinReach(const uint64_t* column, int wordLength, int maxDistance) const {
+        int low = max(0, wordLength - maxDistance);
+        int high = min(length, wordLength + maxDistance);
+        if (low > high) return false;
+
+        // Queries of up to 64 letters fit in one block, walk the band with shifts
+        if (blockCount == 1) {
+            uint64_t below = low ? ~0ull >> (64 - low) : 0;
+            int value = wordLength + popCount64(column[0] & below) - popCount64(column[1] & below);
+            uint64_t vp = low < 64 ? column[0] >> low : 0, vn = low < 64 ? column[1] >> low : 0;
+
+            for (int i = low; value > maxDistance; i++, vp >>= 1, vn >>= 1) {
+                if (i == high) return false;
+                value += (int)(vp & 1) - (int)(vn & 1);
+            }
+            return true;
+        }
+
+        // Value of the first cell of the band from the differences above it
+        int value = wordLength;
+        for (int b = 0; b < low / 64; b++) value += popCount64(column[b]) - popCount64(column[blockCount + b]);
+        if (low % 64) {
+            uint64_t below = (1ull << (low % 64)) - 1;
+            value += popCount64(column[low / 64] & below) - popCount64(column[blockCount + low / 64] & below);
+        }
+
+        for (int i = low; ; i++) {
+            if (value <= maxDistance) return true;
+            if (i == high) return false;
+
+            value += bit(column, i) - bit(column + blockCount, i);
+        }
+    }
+};
+
+// Levenshtein automaton of a query and a maximum distance. A state is a row of the DP table
+// of Trie::fuzzySearch with every value above the maximum distance clamped to one above it,
+// so rows that only differ in cells that can no longer lead to a match are the same state.
+// States and transitions are built the first time a search takes them, after which moving
+// along an edge is a table lookup instead of a row computation
+class LevenshteinAutomaton {
+public:
+    static const int DEAD = -1;
+
+private:
+    static const int UNKNOWN = -2;
+
+    struct State {
+        vector<int> row;
+
+        // Smallest value of the row. Words going on from here are never closer than that
+        int lowest;
+
+        // Next state for each letter, UNKNOWN until first taken
+        int next[26];
+    };
+
+    string query;
+    int maxDistance;
+    vector<State> states;
+    map<vector<int>, int> stateIndex;
+
+    int intern(const vector<int>& row) {
+        auto found = stateIndex.find(row);
+        if (found != stateIndex.end()) return found->second;
+
+        State state;
+        state.row = row;
+        state.lowest = *min_element(row.begin(), row.end());
+        fill(state.next, state.next + 26, UNKNOWN);
+
+        states.push_back(state);
+        stateIndex[row] = (int)states.size() - 1;
+
+        return (int)states.size() - 1;
+    }
+
+public:
+    LevenshteinAutomaton(const string& query, int maxDistance) : query(query), maxDistance(maxDistance) {
+        vector<int> row(query.size() + 1);
+
+        for (int i = 0; i <= (int)query.size(); i++) row[i] = min(i, maxDistance + 1);
+        intern(row);
+    }
+
+    int start() const {
+        return 0;
+    }
+
+    int getMaxDistance() const {
+        return maxDistance;
+    }
+
+    // Distance between the query and the letters read so far, above the maximum if too far
+    int distance(int state) const {
+        return states[state].row.back();
+    }
+
+    // Lower bound of the distance of the words going on from the state
+    int lowerBound(int state) const {
+        return states[state].lowest;
+    }
+
+    // DEAD if no word going on from here can be within the maximum distance
+    int step(int state, char c) {
+        int letter = c - 'a';
+
+        if (states[state].next[letter] == UNKNOWN) {
+            vector<int> row;
+            int rowMin = computeEditRow(query, states[state].row, c, row);
+            int next = DEAD;
+
+            if (rowMin <= maxDistance) {
+                for (int& value : row) value = min(value, maxDistance + 1);
+                next = intern(row);
+            }
+
+            states[state].next[letter] = next;
+        }
+
+        return states[state].next[letter];
+    }
+};
+
+const int LevenshteinAutomaton::DEAD;
+const int LevenshteinAutomaton::UNKNOWN;
+
+// Read-only mapping of a whole file. The file is paged in lazily by the OS as it is read
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile() : data(nullptr), length(0) {}
+
+    bool open(const string& filename) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (mapping == NULL) return false;
+
+        // The view keeps the mapping alive on its own
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == NULL) return false;
+
+        data = (const char*)view;
+        length = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED) return false;
+
+        data = (const char*)view;
+        length = (size_t)info.st_size;
+#endif
+        return true;
+    }
+
+    const char* getData() {
+        return data;
+    }
+
+    size_t size() {
+        return length;
+    }
+
+    ~MappedFile() {
+        if (!data) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, length);
+#endif
+    }
+};
+
+// Array that either owns its elements or is a read-only view into a mapped snapshot
+template <typename T>
+class MappedArray {
+private:
+    vector<T> items;
+    const T* view;
+    size_t viewSize;
+    bool mapped;
+
+public:
+    MappedArray() : view(nullptr), viewSize(0), mapped(false) {}
+
+    // Owned elements, only used while the array is being built
+    vector<T>& owned() {
+        return items;
+    }
+
+    void attach(const T* data, size_t count) {
+        vector<T>().swap(items);
+        view = data;
+        viewSize = count;
+        mapped = true;
+    }
+
+    const T* data() const {
+        return mapped ? view : items.data();
+    }
+
+    size_t size() const {
+        return mapped ? viewSize : items.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T& operator[](size_t i) const {
+        return data()[i];
+    }
+};
+
+// 64-bit FNV-1a hash, used as the snapshot checksum and by the deletion index
+uint64_t fnv1a64(const char* data, size_t length, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Bit vector with constant-time rank and sampled select for the succinct trie
+class BitVector {
+private:
+    friend class LoudsTrie;
+
+    static const size_t BLOCK_BITS = 512;
+    static const size_t WORDS_PER_BLOCK = BLOCK_BITS / 64;
+    static const size_t SELECT_SAMPLE = 64;
+
+    MappedArray<uint64_t> bits;
+    size_t length;
+
+    // Number of ones before each block, and the position of every SELECT_SAMPLE-th zero
+    MappedArray<uint32_t> rankBlocks;
+    MappedArray<uint32_t> zeroSamples;
+
+public:
+    BitVector() : length(0) {}
+
+    size_t size() {
+        return length;
+    }
+
+    void push(bool bit) {
+        if (length % 64 == 0) bits.owned().push_back(0);
+        if (bit) bits.owned().back() |= 1ull << (length % 64);
+        length++;
+    }
+
+    bool get(size_t i) {
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    // Build the rank and select directories once all bits are pushed
+    void build() {
+        vector<uint64_t>& words = bits.owned();
+        vector<uint32_t>& ranks = rankBlocks.owned();
+        vector<uint32_t>& samples = zeroSamples.owned();
+
+        size_t blocks = (words.size() + WORDS_PER_BLOCK - 1) / WORDS_PER_BLOCK;
+        uint32_t ones = 0;
+
+        ranks.assign(blocks + 1, 0);
+        for (size_t w = 0; w < words.size(); w++) {
+            if (w % WORDS_PER_BLOCK == 0) ranks[w / WORDS_PER_BLOCK] = ones;
+            ones += popCount64(words[w]);
+        }
+        ranks[blocks] = ones;
+
+        // Sample the 1st, (SELECT_SAMPLE + 1)-th, ... zero
+        samples.clear();
+        size_t zeros = 0;
+        for (size_t i = 0; i < length; i++) {
+            if (get(i)) continue;
+            if (zeros % SELECT_SAMPLE == 0) samples.push_back((uint32_t)i);
+            zeros++;
+        }
+    }
+
+    // Number of ones in [0, i)
+    size_t rank1(size_t i) {
+        const uint64_t* words = bits.data();
+        size_t block = i / BLOCK_BITS;
+        size_t result = rankBlocks[block];
+
+        for (size_t w = block * WORDS_PER_BLOCK; w < i / 64; w++) result += popCount64(words[w]);
+        if (i % 64) result += popCount64(words[i / 64] & ((1ull << (i % 64)) - 1));
+
+        return result;
+    }
+
+    size_t rank0(size_t i) {
+        return i - rank1(i);
+    }
+
+    // Position of the k-th zero, counting from 1
+    size_t select0(size_t k) {
+        // Start from the closest sampled zero and count the zeros after it word by word
+        size_t sample = (k - 1) / SELECT_SAMPLE;
+        size_t position = zeroSamples[sample];
+        size_t remaining = k - 1 - sample * SELECT_SAMPLE;
+
+        if (remaining == 0) return position;
+
+        const uint64_t* words = bits.data();
+        size_t w = position / 64;
+        uint64_t zeroBits = ~words[w] & ((~0ull << (position % 64)) << 1);
+
+        while (true) {
+            size_t wordZeros = popCount64(zeroBits);
+
+            if (wordZeros >= remaining) {
+                // Drop the lower zeros of the word until the wanted one is the lowest
+                for (size_t j = 1; j < remaining; j++) zeroBits &= zeroBits - 1;
+
+                return w * 64 + countTrailingZeros64(zeroBits);
+            }
+
+            remaining -= wordZeros;
+            zeroBits = ~words[++w];
+        }
+    }
+
+    size_t memoryUsage() {
+        return bits.size() * sizeof(uint64_t) + (rankBlocks.size() + zeroSamples.size()) * sizeof(uint32_t);
+    }
+};
+
+// Read-only trie in LOUDS (level-order unary degree sequence) encoding. Nodes are numbered
+// in breadth-first order from 0 (the root). Every node writes one 1 per child followed by
+// a 0, so the children of node i occupy the bits between the i-th and (i + 1)-th zero, and
+// since the children of a node are numbered consecutively they are found without pointers.
+class LoudsTrie {
+private:
+    BitVector louds;
+    BitVector terminals;
+
+    // Letter on the edge coming into each node, the root has none
+    MappedArray<char> labels;
+    bool enableLogging;
+
+    // Snapshot the arrays point into, if the trie was loaded from one
+    shared_ptr<MappedFile> mapping;
+
+    // Snapshot layout: the header followed by every array padded to 8 bytes. Offsets are
+    // counted from the start of the file, so the arrays are used in place wherever it is mapped
+    static const uint32_t SNAPSHOT_VERSION = 1;
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    enum Section { LOUDS_BITS, LOUDS_RANKS, LOUDS_SAMPLES, TERMINAL_BITS, TERMINAL_RANKS, TERMINAL_SAMPLES, LABELS, SECTION_COUNT };
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t fileSize;
+        uint64_t checksum;
+        uint64_t nodeCount;
+        uint64_t loudsLength;
+        uint64_t terminalsLength;
+        uint64_t offsets[SECTION_COUNT];
+        uint64_t counts[SECTION_COUNT];
+    };
+
+    static size_t elementSize(int section) {
+        if (section == LOUDS_BITS || section == TERMINAL_BITS) return sizeof(uint64_t);
+        if (section == LABELS) return sizeof(char);
+        return sizeof(uint32_t);
+    }
+
+    // Words and rank blocks a bit vector of the given length needs
+    static bool validBitVector(const SnapshotHeader* header, int bitsSection, uint64_t length) {
+        uint64_t words = (length + 63) / 64;
+        uint64_t blocks = (words + BitVector::WORDS_PER_BLOCK - 1) / BitVector::WORDS_PER_BLOCK;
+
+        return header->counts[bitsSection] == words && header->counts[bitsSection + 1] == blocks + 1;
+    }
+
+    bool validSnapshot(const char* data, size_t size, bool verifyChecksum) {
+        if (size < sizeof(SnapshotHeader)) return false;
+
+        const SnapshotHeader* header = (const SnapshotHeader*)data;
+
+        if (memcmp(header->magic, "TRIESNAP", 8) != 0 || header->version != SNAPSHOT_VERSION) return false;
+        if (header->byteOrder != BYTE_ORDER_MARK || header->fileSize != size) return false;
+
+        for (int i = 0; i < SECTION_COUNT; i++) {
+            uint64_t offset = header->offsets[i];
+
+            if (offset % 8 != 0 || offset < sizeof(SnapshotHeader) || offset > size) return false;
+            if (header->counts[i] > (size - offset) / elementSize(i)) return false;
+        }
+
+        // Every node writes one zero to the LOUDS bits and a one for each of its children
+        uint64_t nodes = header->nodeCount;
+        if (header->counts[LABELS] != nodes || header->terminalsLength != nodes) return false;
+        if (header->loudsLength != (nodes == 0 ? 0 : 2 * nodes - 1)) return false;
+        if (header->counts[LOUDS_SAMPLES] != (nodes + BitVector::SELECT_SAMPLE - 1) / BitVector::SELECT_SAMPLE) return false;
+        if (!validBitVector(header, LOUDS_BITS, header->loudsLength)) return false;
+        if (!validBitVector(header, TERMINAL_BITS, header->terminalsLength)) return false;
+
+        return !verifyChecksum || fnv1a64(data + sizeof(SnapshotHeader), size - sizeof(SnapshotHeader)) == header->checksum;
+    }
+
+    bool hasWildcard(const string& word) {
+        return word.find_first_of(REGEX_OPERATORS) != string::npos;
+    }
+
+    // Id of the first child and number of children of a node
+    void childRange(uint32_t node, uint32_t& first, uint32_t& count) {
+        size_t start = node == 0 ? 0 : louds.select0(node) + 1;
+        size_t end = louds.select0(node + 1);
+
+        // Exactly "node" zeros come before start, the remaining bits are ones which each
+        // stand for one child numbered after the root
+        first = (uint32_t)(start - node + 1);
+        count = (uint32_t)(end - start);
+    }
+
+    uint32_t getChild(uint32_t node, char c) {
+        uint32_t first, count;
+        childRange(node, first, count);
+
+        for (uint32_t i = first; i < first + count; i++) {
+            if (labels[i] == c) return i;
+            if (labels[i] > c) break;
+        }
+
+        return NOT_FOUND;
+    }
+
+    void suggestHelper(vector<string>& results, uint32_t node, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (terminals.get(node)) {
+            results.push_back(currentWord);
+        }
+
+        uint32_t first, count;
+        childRange(node, first, count);
+
+        for (uint32_t i = first; i < first + count; i++) {
+            currentWord.push_back(labels[i]);
+            suggestHelper(results, i, currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void searchByRegex(vector<string>& results, RegexAutomaton& regex, int state, uint32_t node, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (regex.accepting(state) && terminals.get(node)) results.push_back(currentWord);
+
+        uint32_t first, count;
+        childRange(node, first, count);
+
+        for (uint32_t i = first; i < first + count; i++) {
+            if (!(regex.letters(state) & (1u << (labels[i] - 'a')))) continue;
+
+            int next = regex.step(state, labels[i]);
+            if (next == RegexAutomaton::DEAD) continue;
+
+            currentWord.push_back(labels[i]);
+            searchByRegex(results, regex, next, i, currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void fuzzySearchHelper(uint32_t node, const string& query, int maxDistance,
+        const vector<int>& previousRow, string& currentWord, vector<pair<string, int>>& results) {
+
+        vector<int> currentRow;
+        int rowMin = computeEditRow(query, previousRow, currentWord.back(), currentRow);
+
+        if (currentRow.back() <= maxDistance && terminals.get(node)) {
+            results.push_back({ currentWord, currentRow.back() });
+        }
+
+        if (rowMin > maxDistance) return;
+
+        uint32_t first, count;
+        childRange(node, first, count);
+
+        for (uint32_t i = first; i < first + count; i++) {
+            currentWord.push_back(labels[i]);
+            fuzzySearchHelper(i, query, maxDistance, currentRow, currentWord, results);
+            currentWord.pop_back();
+        }
+    }
+
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    LoudsTrie() : enableLogging(true) {}
+
+    void setLogging(bool enable) {
+        enableLogging = enable;
+    }
+
+    // Nodes have to be appended in breadth-first order with their children in
+    // alphabetical order, then finish() builds the rank and select directories
+    void appendNode(char label, bool isEndOfWord, uint32_t childMask) {
+        for (uint32_t bits = childMask; bits; bits &= bits - 1) louds.push(true);
+        louds.push(false);
+
+        terminals.push(isEndOfWord);
+        labels.owned().push_back(label);
+    }
+
+    void finish() {
+        louds.build();
+        terminals.build();
+        labels.owned().shrink_to_fit();
+    }
+
+    // Write the trie as a snapshot that loadSnapshot() can map and query without parsing
+    bool saveSnapshot(const string& filename) {
+        const char* sections[SECTION_COUNT] = {
+            (const char*)louds.bits.data(), (const char*)louds.rankBlocks.data(), (const char*)louds.zeroSamples.data(),
+            (const char*)terminals.bits.data(), (const char*)terminals.rankBlocks.data(), (const char*)terminals.zeroSamples.data(),
+            labels.data()
+        };
+        size_t counts[SECTION_COUNT] = {
+            louds.bits.size(), louds.rankBlocks.size(), louds.zeroSamples.size(),
+            terminals.bits.size(), terminals.rankBlocks.size(), terminals.zeroSamples.size(),
+            labels.size()
+        };
+        static const char padding[8] = {};
+
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "TRIESNAP", 8);
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.nodeCount = labels.size();
+        header.loudsLength = louds.length;
+        header.terminalsLength = terminals.length;
+
+        // Lay out the sections and checksum them in the order they are written
+        uint64_t offset = sizeof(header);
+        uint64_t checksum = fnv1a64(nullptr, 0);
+        size_t paddings[SECTION_COUNT];
+
+        for (int i = 0; i < SECTION_COUNT; i++) {
+            size_t bytes = counts[i] * elementSize(i);
+
+            header.offsets[i] = offset;
+            header.counts[i] = counts[i];
+            paddings[i] = (8 - bytes % 8) % 8;
+
+            checksum = fnv1a64(sections[i], bytes, checksum);
+            checksum = fnv1a64(padding, paddings[i], checksum);
+            offset += bytes + paddings[i];
+        }
+
+        header.fileSize = offset;
+        header.checksum = checksum;
+
+        ofstream file(filename, ios::binary | ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+
+        for (int i = 0; i < SECTION_COUNT; i++) {
+            file.write(sections[i], counts[i] * elementSize(i));
+            file.write(padding, paddings[i]);
+        }
+
+        if (!file) {
+            if (enableLogging) log("[LOUDS Trie]: Could not write snapshot " + filename, RED);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Map a snapshot read-only and point the trie at it, so startup costs no parsing. The
+    // checksum pass reads the whole file once, skip it to only touch the pages queries need
+    bool loadSnapshot(const string& filename, bool verifyChecksum = true) {
+        shared_ptr<MappedFile> file = make_shared<MappedFile>();
+
+        if (!file->open(filename)) {
+            if (enableLogging) log("[LOUDS Trie]: Could not map snapshot " + filename, RED);
+            return false;
+        }
+
+        if (!validSnapshot(file->getData(), file->size(), verifyChecksum)) {
+            if (enableLogging) log("[LOUDS Trie]: Invalid or corrupted snapshot " + filename, RED);
+            return false;
+        }
+
+        const char* data = file->getData();
+        const SnapshotHeader* header = (const SnapshotHeader*)data;
+
+        louds.length = header->loudsLength;
+        louds.bits.attach((const uint64_t*)(data + header->offsets[LOUDS_BITS]), header->counts[LOUDS_BITS]);
+        louds.rankBlocks.attach((const uint32_t*)(data + header->offsets[LOUDS_RANKS]), header->counts[LOUDS_RANKS]);
+        louds.zeroSamples.attach((const uint32_t*)(data + header->offsets[LOUDS_SAMPLES]), header->counts[LOUDS_SAMPLES]);
+
+        terminals.length = header->terminalsLength;
+        terminals.bits.attach((const uint64_t*)(data + header->offsets[TERMINAL_BITS]), header->counts[TERMINAL_BITS]);
+        terminals.rankBlocks.attach((const uint32_t*)(data + header->offsets[TERMINAL_RANKS]), header->counts[TERMINAL_RANKS]);
+        terminals.zeroSamples.attach((const uint32_t*)(data + header->offsets[TERMINAL_SAMPLES]), header->counts[TERMINAL_SAMPLES]);
+
+        labels.attach(data + header->offsets[LABELS], header->counts[LABELS]);
+        mapping = file;
+
+        return true;
+    }
+
+    size_t getNodeCount() {
+        return labels.size();
+    }
+
+    // Bytes used by the bit vectors, their directories and the labels
+    size_t getMemoryUsage() {
+        return louds.memoryUsage() + terminals.memoryUsage() + labels.size();
+    }
+
+    // Returns the node where the prefix ends, or NOT_FOUND
+    uint32_t searchPrefix(const string& prefix) {
+        if (labels.empty()) return NOT_FOUND;
+
+        uint32_t node = 0;
+
+        for (char c : prefix) {
+            node = getChild(node, c);
+            if (node == NOT_FOUND) return NOT_FOUND;
+        }
+
+        return node;
+    }
+
+    bool isEndOfWord(uint32_t node) {
+        return terminals.get(node);
+    }
+
+    vector<string> suggest(const string& prefix, int wordLimit = 10) {
+        vector<string> results;
+
+        if (!hasWildcard(prefix)) {
+            uint32_t node = searchPrefix(prefix);
+            string currentWord = prefix;
+
+            if (node != NOT_FOUND) suggestHelper(results, node, currentWord, wordLimit);
+        }
+        else {
+            RegexAutomaton regex;
+            string currentWord;
+
+            if (!regex.compile(prefix)) {
+                if (enableLogging) log("[LOUDS Trie]: Invalid regex: " + prefix, RED);
+            }
+            else if (!labels.empty() && regex.start() != RegexAutomaton::DEAD) {
+                searchByRegex(results, regex, regex.start(), 0, currentWord, wordLimit);
+            }
+        }
+
+        return results;
+    }
+
+    vector<string> fuzzySearch(const string& query, int maxDistance = 1, int wordLimit = 10) {
+        vector<pair<string, int>> results;
+        if (labels.empty()) return {};
+
+        vector<int> firstRow(query.size() + 1);
+        for (size_t i = 0; i <= query.size(); ++i) {
+            firstRow[i] = i;
+        }
+
+        uint32_t first, count;
+        childRange(0, first, count);
+
+        string currentWord = "";
+        for (uint32_t i = first; i < first + count; i++) {
+            currentWord.push_back(labels[i]);
+            fuzzySearchHelper(i, query, maxDistance, firstRow, currentWord, results);
+            currentWord.pop_back();
+        }
+
+        // Sort the results by Levenshtein distance. Words at the same distance stay in alphabetical order
+        stable_sort(results.begin(), results.end(), [](const pair<string, int>& a, const pair<string, int>& b) {
+            return a.second < b.second;
+            });
+
+        vector<string> finalResults;
+        for (int i = 0; i < (int)results.size() && i < wordLimit; i++) {
+            finalResults.push_back(results[i].first);
+        }
+
+        return finalResults;
+    }
+};
+
+const uint32_t LoudsTrie::NOT_FOUND;
+const uint32_t LoudsTrie::SNAPSHOT_VERSION;
+const uint32_t LoudsTrie::BYTE_ORDER_MARK;
+
+// Symmetric deletion index (SymSpell) for fuzzy search. Every word is filed under all the
+// strings made by deleting up to maxDistance of its letters. A word within distance d of a
+// query shares one of them with a string made by deleting up to d letters of the query, so
+// looking up the deletions of the query gives every candidate without walking the trie.
+// Deletions are only kept as 32-bit hashes: a collision adds a candidate, and candidates
+// are all checked with the edit distance anyway. A word of n letters has about n^d
+// deletions, so the index trades a lot of memory for speed and is meant for 1 or 2
+class DeletionIndex {
+private:
+    int maxDistance;
+
+    // Words by ID. A removed word keeps its ID and postings and is only marked dead, so
+    // inserting it again just brings it back
+    vector<string> words;
+    vector<bool> alive;
+    unordered_map<string, uint32_t> ids;
+    size_t liveCount;
+
+    // Postings as (hash << 32 | ID), sorted so that the IDs filed under a hash are one range
+    vector<uint64_t> postings;
+
+    // Postings of the words inserted since, merged into the sorted ones once they are
+    // an eighth of them
+    unordered_map<uint32_t, vector<uint32_t>> recent;
+    size_t recentCount;
+
+    // Searches share the index, insert and remove have it to themselves
+    mutable shared_timed_mutex lock;
+
+    static uint32_t hashOf(const string& s) {
+        uint64_t hash = fnv1a64(s.data(), s.size());
+        return (uint32_t)(hash ^ (hash >> 32));
+    }
+
+    // Deleting positions in increasing order makes each set of positions once. Repeated
+    // letters can still give the same string twice, deletions() drops those
+    static void addDeletions(string& word, size_t start, int remaining, vector<uint32_t>& hashes) {
+        if (remaining <= 0) return;
+
+        for (size_t i = start; i < word.size(); i++) {
+            char c = word[i];
+            word.erase(i, 1);
+            hashes.push_back(hashOf(word));
+            addDeletions(word, i, remaining - 1, hashes);
+            word.insert(i, 1, c);
+        }
+    }
+
+    // Hashes of the word and of every string made by deleting up to "distance" of its letters
+    static void deletions(const string& word, int distance, vector<uint32_t>& hashes) {
+        string scratch = word;
+
+        hashes.clear();
+        hashes.push_back(hashOf(scratch));
+        addDeletions(scratch, 0, distance, hashes);
+
+        sort(hashes.begin(), hashes.end());
+        hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+    }
+
+    uint32_t addWord(const string& word, vector<uint32_t>& hashes) {
+        uint32_t id = (uint32_t)words.size();
+
+        words.push_back(word);
+        alive.push_back(true);
+        ids[word] = id;
+        liveCount++;
+
+        deletions(word, maxDistance, hashes);
+        return id;
+    }
+
+    void merge() {
+        size_t middle = postings.size();
+
+        for (auto& entry : recent) {
+            for (uint32_t id : entry.second) postings.push_back((uint64_t)entry.first << 32 | id);
+        }
+
+        sort(postings.begin() + middle, postings.end());
+        inplace_merge(postings.begin(), postings.begin() + middle, postings.end());
+
+        recent.clear();
+        recentCount = 0;
+    }
+
+public:
+    DeletionIndex(int maxDistance) : maxDistance(maxDistance), liveCount(0), recentCount(0) {}
+
+    int getMaxDistance() const {
+        return maxDistance;
+    }
+
+    // Number of words in the index
+    size_t size() const {
+        return liveCount;
+    }
+
+    // Number of (deletion, word) pairs, removed words included
+    size_t getPostingCount() const {
+        return postings.size() + recentCount;
+    }
+
+    void clear() {
+        unique_lock<shared_timed_mutex> guard(lock);
+
+        words.clear();
+        alive.clear();
+        ids.clear();
+        postings.clear();
+        recent.clear();
+        liveCount = recentCount = 0;
+    }
+
+    // Replace the contents with the given words, sorting the postings once
+    void build(const vector<string>& list) {
+        unique_lock<shared_timed_mutex> guard(lock);
+
+        words.clear();
+        alive.clear();
+        ids.clear();
+        postings.clear();
+        recent.clear();
+        liveCount = recentCount = 0;
+
+        vector<uint32_t> hashes;
+        for (const string& word : list) {
+            if (ids.count(word)) continue;
+
+            uint32_t id = addWord(word, hashes);
+            for (uint32_t hash : hashes) postings.push_back((uint64_t)hash << 32 | id);
+        }
+
+        sort(postings.begin(), postings.end());
+    }
+
+    void insert(const string& word) {
+        unique_lock<shared_timed_mutex> guard(lock);
+
+        auto it = ids.find(word);
+        if (it != ids.end()) {
+            if (!alive[it->second]) {
+                alive[it->second] = true;
+                liveCount++;
+            }
+            return;
+        }
+
+        vector<uint32_t> hashes;
+        uint32_t id = addWord(word, hashes);
+
+        for (uint32_t hash : hashes) recent[hash].push_back(id);
+        recentCount += hashes.size();
+
+        if (recentCount > postings.size() / 8 + 1024) merge();
+    }
+
+    void remove(const string& word) {
+        unique_lock<shared_timed_mutex> guard(lock);
+
+        auto it = ids.find(word);
+        if (it != ids.end() && alive[it->second]) {
+            alive[it->second] = false;
+            liveCount--;
+        }
+    }
+
+    // Words within maxDistance (at most the index distance) of the query, by distance and
+    // then in alphabetical order like Trie::fuzzySearch
+    vector<string> search(const string& query, int maxDistance, int wordLimit) const {
+        if (maxDistance < 0) return {};
+
+        shared_lock<shared_timed_mutex> guard(lock);
+
+        vector<uint32_t> hashes;
+        deletions(query, min(maxDistance, this->maxDistance), hashes);
+
+        // Words sharing a deletion with the query
+        vector<uint32_t> candidates;
+        for (uint32_t hash : hashes) {
+            uint64_t key = (uint64_t)hash << 32;
+            for (auto it = lower_bound(postings.begin(), postings.end(), key); it != postings.end() && (*it >> 32) == hash; ++it) {
+                candidates.push_back((uint32_t)*it);
+            }
+
+            auto added = recent.find(hash);
+            if (added != recent.end()) candidates.insert(candidates.end(), added->second.begin(), added->second.end());
+        }
+
+        sort(candidates.begin(), candidates.end());
+        candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+        // Check them with the bit-parallel kernel, stopping a word once no suffix can
+        // bring it back within the distance
+        EditDistanceKernel kernel(query);
+        vector<uint64_t> column(kernel.stride()), next(kernel.stride());
+        vector<pair<int, const string*>> matches;
+
+        for (uint32_t id : candidates) {
+            const string& word = words[id];
+            if (!alive[id] || abs((int)word.size() - (int)query.size()) > maxDistance) continue;
+
+            int distance = (int)query.size();
+            kernel.init(column.data());
+
+            for (size_t k = 0; k < word.size(); k++) {
+                distance = kernel.step(column.data(), k ? word[k - 1] : 0, word[k], next.data(), distance);
+                column.swap(next);
+
+                if (!kernel.withinReach(column.data(), (int)k + 1, maxDistance)) {
+                    distance = maxDistance + 1;
+                    break;
+                }
+            }
+
+            if (distance <= maxDistance) matches.push_back({ distance, &word });
+        }
+
+        sort(matches.begin(), matches.end(), [](const pair<int, const string*>& a, const pair<int, const string*>& b) {
+            return a.first != b.first ? a.first < b.first : *a.second < *b.second;
+            });
+
+        vector<string> results;
+        for (int i = 0; i < (int)matches.size() && i < wordLimit; i++) {
+            results.push_back(*matches[i].second);
+        }
+
+        return results;
+    }
+};
+
+// Suggestions written one after another into a single block of characters. Clearing keeps
+// the memory, so a buffer reused across queries stops allocating once it is large enough
+class SuggestionBuffer {
+private:
+    string chars;
+
+    // Offset in chars where each word ends
+    vector<uint32_t> ends;
+
+    // Path buffer of the search filling the buffer
+    string path;
+
+    friend class Trie;
+
+public:
+    void clear() {
+        chars.clear();
+        ends.clear();
+    }
+
+    void reserve(size_t wordCount, size_t charCount) {
+        ends.reserve(wordCount);
+        chars.reserve(charCount);
+    }
+
+    void append(const string& word) {
+        chars.append(word);
+        ends.push_back((uint32_t)chars.size());
+    }
+
+    size_t size() const {
+        return ends.size();
+    }
+
+    bool empty() const {
+        return ends.empty();
+    }
+
+    // Characters of the i-th word, not null-terminated
+    const char* data(size_t i) const {
+        return chars.data() + (i == 0 ? 0 : ends[i - 1]);
+    }
+
+    size_t length(size_t i) const {
+        return ends[i] - (i == 0 ? 0 : ends[i - 1]);
+    }
+
+    // Copy of the i-th word
+    string word(size_t i) const {
+        return string(data(i), length(i));
+    }
+};
+
+// Epoch-based reclamation for the concurrent mode of the trie. Readers announce the epoch
+// they started in, and nodes retired by a writer are only released once the epoch has
+// advanced twice since, when no reader that could have reached them is left.
+// There are four reader slots per hardware thread and at least 64. Entering is wait-free
+// as long as no more readers than that run at once, a reader beyond it sleeps until a
+// slot is handed back instead of spinning
+class EpochManager {
+private:
+    static const int MIN_READER_SLOTS = 64;
+
+    // Epoch announced by an active reader, 0 if the slot is free. Every slot gets a cache
+    // line of its own so that readers on different cores do not contend
+    struct ReaderSlot {
+        atomic<uint64_t> epoch;
+        char padding[64 - sizeof(atomic<uint64_t>)];
+    };
+
+    unique_ptr<ReaderSlot[]> slots;
+    int slotCount;
+    atomic<uint64_t> globalEpoch;
+
+    // Readers waiting for a free slot
+    atomic<int> waiting;
+    mutex waitLock;
+    condition_variable slotFreed;
+
+    // Retired nodes and the epoch they were retired in, oldest first. Only writers use it
+    vector<pair<uint64_t, vector<uint32_t>>> limbo;
+
+public:
+    EpochManager() : slotCount(max<int>(MIN_READER_SLOTS, 4 * thread::hardware_concurrency())), globalEpoch(1), waiting(0) {
+        slots.reset(new ReaderSlot[slotCount]);
+        for (int i = 0; i < slotCount; i++) slots[i].epoch.store(0);
+    }
+
+    int getSlotCount() {
+        return slotCount;
+    }
+
+    // Returns the slot to hand back to exit(). The search starts at a slot picked by the
+    // thread id, so it only goes further when many readers run at once
+    int enter() {
+        size_t start = hash<thread::id>()(this_thread::get_id());
+
+        while (true) {
+            uint64_t epoch = globalEpoch.load();
+
+            for (int k = 0; k < slotCount; k++) {
+                int index = (int)((start + k) % slotCount);
+                uint64_t expected = 0;
+
+                if (slots[index].epoch.compare_exchange_strong(expected, epoch)) return index;
+            }
+
+            // Every slot is taken. The timeout covers a slot freed between the search and the wait
+            unique_lock<mutex> lock(waitLock);
+            waiting++;
+            slotFreed.wait_for(lock, milliseconds(1));
+            waiting--;
+        }
+    }
+
+    void exit(int index) {
+        slots[index].epoch.store(0);
+
+        if (waiting.load() > 0) {
+            lock_guard<mutex> lock(waitLock);
+            slotFreed.notify_one();
+        }
+    }
+
+    // Called after the nodes were unlinked from the published trie
+    void retire(vector<uint32_t>& nodes) {
+        limbo.push_back({ globalEpoch.load(), move(nodes) });
+    }
+
+    // Advance the epoch if every active reader has caught up with it, then release the
+    // nodes retired at least two epochs ago
+    void reclaim(NodePool& pool) {
+        uint64_t epoch = globalEpoch.load();
+        bool caughtUp = true;
+
+        for (int i = 0; i < slotCount; i++) {
+            uint64_t announced = slots[i].epoch.load();
+            if (announced != 0 && announced != epoch) {
+                caughtUp = false;
+                break;
+            }
+        }
+
+        if (caughtUp) globalEpoch.store(++epoch);
+
+        size_t released = 0;
+        while (released < limbo.size() && limbo[released].first + 2 <= epoch) {
+            for (uint32_t node : limbo[released].second) pool.release(node);
+            released++;
+        }
+
+        limbo.erase(limbo.begin(), limbo.begin() + released);
+    }
+
+    // Release every retired node at once, only while no reader is active
+    void drain(NodePool& pool) {
+        for (auto& retired : limbo) {
+            for (uint32_t node : retired.second) pool.release(node);
+        }
+
+        limbo.clear();
+    }
+
+    // Forget the retired nodes after the pool they came from was reset
+    void clear() {
+        limbo.clear();
+    }
+};
+
+const int EpochManager::MIN_READER_SLOTS;
+
+class Trie {
+private:
+    NodePool pool;
+    atomic<uint32_t> root;
+    CacheManager* cache;
+	bool enableLogging;
+    bool enableCaching;
+
+    // Concurrent mode, see setConcurrentReads()
+    bool concurrentReads;
+    EpochManager epochs;
+    mutex writeLock;
+
+    // Largest distance of the fuzzy queries put in the cache, see invalidateCache()
+    atomic<int> maxCachedDistance;
+
+    // Deletion index answering fuzzySearch, see setDeletionIndex()
+    DeletionIndex* deletionIndex;
+
+    // Word or prefix waiting in fuzzySearchBestFirst. Entries come out by distance, or lowest
+    // possible distance for a prefix, then in alphabetical order. A word comes before the
+    // prefix of the same letters, whose words are all longer
+    struct FuzzyEntry {
+        int distance;
+        bool isWord;
+        string word;
+        uint32_t node;
+        int state;
+
+        bool operator>(const FuzzyEntry& other) const {
+            if (distance != other.distance) return distance > other.distance;
+            if (word != other.word) return word > other.word;
+            return isWord < other.isWord;
+        }
+    };
+
+    // Bumped by every change to the nodes, see CompletionSession
+    atomic<uint64_t> version;
+
+    friend class CompletionSession;
+    friend class CompletionIterator;
+
+    // Keeps the reader registered with the epoch manager for the duration of a query
+    struct ReadGuard {
+        EpochManager* epochs;
+        int slot;
+
+        ReadGuard(EpochManager& manager, bool active) : epochs(active ? &manager : nullptr), slot(active ? manager.enter() : -1) {}
+
+        ~ReadGuard() {
+            if (epochs) epochs->exit(slot);
+        }
+    };
+
+    // The counter is only kept when a single thread uses the trie
+    void countComparison() {
+        if (!concurrentReads) comparisons++;
+    }
+
+    // Indices of the nodes along the word from the root, as far as they exist
+    vector<uint32_t> findPath(const string& word) {
+        vector<uint32_t> path = { root };
+
+        for (char c : word) {
+            uint32_t next = pool.getChild(pool.get(path.back()), c - 'a');
+            if (next == NULL_NODE) break;
+
+            path.push_back(next);
+        }
+
+        return path;
+    }
+
+    // Copy the nodes path[0..depth) so they lead to "replacement" instead of path[depth],
+    // publish the copied root and retire every node of the old path
+    void publishPath(const string& word, vector<uint32_t>& path, size_t depth, uint32_t replacement) {
+        uint32_t below = replacement;
+
+        for (size_t j = depth; j-- > 0;) {
+            uint32_t copy = pool.clone(path[j]);
+            TrieNode* node = pool.get(copy);
+
+            pool.setChild(node, word[j] - 'a', below);
+            refreshMaxScore(pool, node);
+            below = copy;
+        }
+
+        root = below;
+
+        // Sessions holding the old nodes must see the change before the nodes can be reclaimed
+        version++;
+        epochs.retire(path);
+        epochs.reclaim(pool);
+    }
+
+    // Copy-on-write insert for the concurrent mode. The score is only set if hasScore
+    void insertConcurrent(const string& word, bool hasScore, uint32_t score) {
+        vector<uint32_t> path = findPath(word);
+        size_t depth = path.size() - 1;
+        TrieNode* last = pool.get(path.back());
+
+        if (depth == word.size() && last->isEndOfWord && (!hasScore || last->score == score)) return;
+
+        uint32_t replacement = pool.clone(path.back());
+        TrieNode* node = pool.get(replacement);
+
+        if (depth == word.size()) {
+            node->isEndOfWord = true;
+            if (hasScore) node->score = score;
+        }
+        else {
+            // The missing letters go below a new node that no reader can reach yet
+            uint32_t tail = pool.allocate();
+            uint32_t end = insertInto(pool, tail, word, depth + 1);
+
+            if (hasScore) pool.get(end)->score = score;
+            computeMaxScores(pool, tail);
+            pool.addChild(node, word[depth] - 'a', tail);
+        }
+
+        refreshMaxScore(pool, node);
+        publishPath(word, path, depth, replacement);
+    }
+
+    // Copy-on-write remove for the concurrent mode
+    void removeConcurrent(const string& word) {
+        vector<uint32_t> path = findPath(word);
+        if (path.size() - 1 != word.size() || !pool.get(path.back())->isEndOfWord) return;
+
+        size_t depth = word.size();
+        uint32_t replacement;
+
+        if (depth == 0 || pool.get(path.back())->childMask) {
+            replacement = pool.clone(path.back());
+            pool.get(replacement)->isEndOfWord = false;
+            pool.get(replacement)->score = 0;
+        }
+        else {
+            // Cut below the deepest node that still leads to another word
+            depth--;
+            while (depth > 0 && !pool.get(path[depth])->isEndOfWord && popCount(pool.get(path[depth])->childMask) == 1) depth--;
+
+            replacement = pool.clone(path[depth]);
+            pool.removeChild(pool.get(replacement), word[depth] - 'a');
+        }
+
+        refreshMaxScore(pool, pool.get(replacement));
+        publishPath(word, path, depth, replacement);
+    }
+
+    TrieNode* child(TrieNode* node, int i) {
+        uint32_t index = pool.getChild(node, i);
+        return index != NULL_NODE ? pool.get(index) : nullptr;
+    }
+
+    bool hasWildcard(const string& word) {
+        return word.find_first_of(REGEX_OPERATORS) != string::npos;
+    }
+
+    // Cache groups of the regex and fuzzy entries, keyed by the length of the words a regex
+    // matches (-1 if they differ in length) or by the query length
+    static int regexGroup(int length) { return 2 * (length + 1); }
+    static int fuzzyGroup(int length) { return 2 * length + 1; }
+
+    // Drop the cache entries whose suggestions may change after the word is inserted or removed:
+    // the prefixes of the word, the regexes matching it and the fuzzy queries within reach of it.
+    // Cache keys start with "p", "r" or "f" for the prefix, regex and fuzzy entries
+    void invalidateCache(const string& word) {
+        for (size_t i = 0; i <= word.size(); i++) {
+            cache->remove("p" + word.substr(0, i));
+        }
+
+        // Regex entries matching words of its length or of any length, and fuzzy entries whose
+        // query is close enough in length. Each entry tests the word itself, see suggest()
+        // and fuzzyMatcher()
+        int length = (int)word.size();
+        int reach = maxCachedDistance;
+        cache->removeAffected([length, reach](int group) {
+            if (group % 2 == 0) return group == regexGroup(length) || group == regexGroup(-1);
+            return abs((group - 1) / 2 - length) <= reach;
+            }, word);
+    }
+
+    // Test for the cache entry of a fuzzy query: the word changes its results if it is
+    // within the distance
+    static function<bool(const string&)> fuzzyMatcher(const string& query, int maxDistance, bool transpositions = false) {
+        return [query, maxDistance, transpositions](const string& word) {
+            if (abs((int)query.size() - (int)word.size()) > maxDistance) return false;
+            return editDistance(query, word, transpositions) <= maxDistance;
+        };
+    }
+
+    // Two words are never further apart than the longer one is long, so distances are capped
+    // at the query length or MAX_FUZZY_DISTANCE, whichever is larger. Only words longer than
+    // MAX_FUZZY_DISTANCE letters could tell the difference
+    static int cappedDistance(const string& query, int maxDistance) {
+        return min(maxDistance, max(MAX_FUZZY_DISTANCE, (int)query.size()));
+    }
+
+    // Add the letters of the word from position "from" on below the given node. Returns
+    // the node where the word ends
+    static uint32_t insertInto(NodePool& target, uint32_t node, const string& word, size_t from) {
+        TrieNode* current = target.get(node);
+
+        for (size_t k = from; k < word.size(); k++) {
+            int idx = word[k] - 'a';
+            uint32_t next = target.getChild(current, idx);
+
+            if (next == NULL_NODE) {
+                next = target.allocate();
+                target.addChild(current, idx, next);
+            }
+
+            current = target.get(next);
+            node = next;
+        }
+
+        current->isEndOfWord = true;
+
+        return node;
+    }
+
+    // Best score of the subtree from the node's own score and the best scores of its children
+    static void refreshMaxScore(NodePool& target, TrieNode* node) {
+        uint32_t best = node->isEndOfWord ? node->score : 0;
+
+        for (int k = popCount(node->childMask) - 1; k >= 0; k--) {
+            best = max(best, target.get(*target.slot(node->children + k))->maxScore);
+        }
+
+        node->maxScore = best;
+    }
+
+    // Fill in the best scores of a whole subtree built without them
+    static uint32_t computeMaxScores(NodePool& target, uint32_t index) {
+        TrieNode* node = target.get(index);
+        uint32_t best = node->isEndOfWord ? node->score : 0;
+
+        for (int k = popCount(node->childMask) - 1; k >= 0; k--) {
+            best = max(best, computeMaxScores(target, *target.slot(node->children + k)));
+        }
+
+        node->maxScore = best;
+
+        return best;
+    }
+
+    // Refresh the best scores on the path of a word after its score changed or it was
+    // removed. Going up stops at the first node whose best score stays the same
+    void refreshPath(const string& word) {
+        vector<TrieNode*> path = { pool.get(root) };
+
+        for (char c : word) {
+            uint32_t next = pool.getChild(path.back(), c - 'a');
+            if (next == NULL_NODE) break;
+
+            path.push_back(pool.get(next));
+        }
+
+        for (size_t k = path.size(); k-- > 0;) {
+            uint32_t previous = path[k]->maxScore;
+
+            refreshMaxScore(pool, path[k]);
+            if (path[k]->maxScore == previous) break;
+        }
+    }
+
+    // Dictionary lines may carry a score after a tab. Cuts it off the line and returns
+    // it, or -1 if there is none
+    static long long splitScore(string& line) {
+        size_t tab = line.find('\t');
+        if (tab == string::npos) return -1;
+
+        long long score = atoll(line.c_str() + tab + 1);
+        line.resize(tab);
+
+        return max(0ll, min<long long>(score, UINT32_MAX));
+    }
+
+    // Entry of the ranked search queue: either a word ready to be reported or a subtree
+    // that is still to be expanded, with the best score it can yield
+    struct RankedEntry {
+        uint32_t score;
+        string word;
+        TrieNode* node;
+        bool isWord;
+    };
+
+    // Higher scores first, then alphabetical order. A subtree goes before the word at its
+    // own root, so it is never ranked behind a word it contains
+    struct RankedOrder {
+        bool operator()(const RankedEntry& a, const RankedEntry& b) const {
+            if (a.score != b.score) return a.score < b.score;
+            if (a.word != b.word) return a.word > b.word;
+            return a.isWord && !b.isWord;
+        }
+    };
+
+    // Returns true if the node was released, so the parent can unlink it
+    bool removeHelper(const string& word, uint32_t currentIndex, int idx) {
+        if (currentIndex == NULL_NODE) {
+			return false;
+        }
+
+        TrieNode* current = pool.get(currentIndex);
+
+        // If the character reaches the end of word
+        if (idx == word.size()) {
+            if (current->isEndOfWord) {
+                current->isEndOfWord = false;
+                current->score = 0;
+            }
+
+            // If the character is the actual end of word. In case the removing word
+            // is shorter than an existing word, do not delete
+            if (isEmpty(current) && currentIndex != root) {
+                pool.release(currentIndex);
+                return true;
+            }
+
+            return false;
+        }
+
+        int i = word[idx] - 'a';
+
+        // Recursively iterate every character of the word
+        if (removeHelper(word, pool.getChild(current, i), idx + 1)) {
+            pool.removeChild(current, i);
+        }
+
+        // If the current character has not child (or its child was removed earlier)
+        // and it is not the end of another word (this is the case which the removing word
+        // is longer than an existing word)
+        if (isEmpty(current) && !current->isEndOfWord && currentIndex != root) {
+            pool.release(currentIndex);
+            return true;
+        }
+
+        return false;
+    }
+
+    void suggestHelper(vector<string>& results, TrieNode* currentNode, string& currentWord, int wordLimit) {
+        countComparison();
+        if (!currentNode || results.size() >= wordLimit) {
+            return;
+        }
+
+        // If the character is the end of an existing word, add it to the list
+        countComparison();
+        if (currentNode->isEndOfWord) {
+            results.push_back(currentWord);
+        }
+
+        // Explore all possible continuations. Only the letters set in the mask are visited
+        for (uint32_t bits = currentNode->childMask; bits; bits &= bits - 1) {
+			countComparison();
+            int i = countTrailingZeros(bits);
+
+            // Append a character to make a new word
+            currentWord.push_back('a' + i);
+            suggestHelper(results, child(currentNode, i), currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+        countComparison();
+    }
+
+    // First 8 bytes of the text, padded with zeros, as a number that compares like the text
+    static uint64_t sortKey(const string& text) {
+        uint64_t key = 0;
+        for (size_t i = 0; i < 8; i++) key = key << 8 | (i < text.size() ? (unsigned char)text[i] : 0);
+
+        return key;
+    }
+
+    // Copy the words of "shorter", the list of a shorter prefix, that start with "prefix".
+    // Lists are in alphabetical order, so those words are a contiguous run of it, all in it
+    // if the list holds every word below the shorter prefix or goes past the run. Returns
+    // false, copying nothing, if the list may miss some
+    static bool refineFrom(const vector<string>& shorter, bool complete, const string& prefix, vector<string>& words) {
+        if (!complete && (shorter.empty() || shorter.back() <= prefix || shorter.back().compare(0, prefix.size(), prefix) == 0)) {
+            return false;
+        }
+
+        auto it = lower_bound(shorter.begin(), shorter.end(), prefix);
+        for (; it != shorter.end() && it->compare(0, prefix.size(), prefix) == 0; ++it) {
+            words.push_back(*it);
+        }
+
+        return true;
+    }
+
+    // Answer the plain queries order[begin..end) for suggestBatch. The order is sorted, so
+    // path[k] still holds the node after the first k letters of the previous query and
+    // only the letters after the ones it shares with this query are walked. The queries
+    // extending a query come right after it: "answered" holds the earlier ones that are a
+    // prefix of this one, longest last, and their results keep one extra word until they
+    // leave it, which tells whether the list holds every word below them
+    void suggestBatchRange(const vector<string>& queries, const vector<size_t>& order, size_t begin, size_t end, int wordLimit, vector<vector<string>>& results) {
+        ReadGuard guard(epochs, concurrentReads);
+
+        struct Answered {
+            size_t query;
+
+            // True if the results are every word below the query
+            bool complete;
+        };
+
+        vector<Answered> answered;
+        vector<uint32_t> path = { root };
+        const string* previous = nullptr;
+        string scratch;
+
+        auto leave = [&]() {
+            vector<string>& words = results[answered.back().query];
+            if (words.size() > (size_t)wordLimit) words.pop_back();
+            answered.pop_back();
+        };
+
+        for (size_t k = begin; k < end; k++) {
+            const string& query = queries[order[k]];
+            vector<string>& words = results[order[k]];
+
+            size_t common = 0;
+            if (previous) {
+                size_t limit = min(query.size(), previous->size());
+                while (common < limit && query[common] == (*previous)[common]) common++;
+            }
+            previous = &query;
+
+            path.resize(common + 1);
+            for (size_t i = common; i < query.size(); i++) {
+                uint32_t node = path.back();
+                char c = query[i];
+                path.push_back(node == NULL_NODE || c < 'a' || c > 'z' ? NULL_NODE : pool.getChild(pool.get(node), c - 'a'));
+            }
+
+            while (!answered.empty() && query.compare(0, queries[answered.back().query].size(), queries[answered.back().query]) != 0) {
+                leave();
+            }
+
+            if (!answered.empty() && queries[answered.back().query] == query) {
+                words = results[answered.back().query];
+                if (words.size() > (size_t)wordLimit) words.pop_back();
+                continue;
+            }
+
+            bool extended = k + 1 < end && queries[order[k + 1]].compare(0, query.size(), query) == 0;
+            bool complete = true;
+
+            if (path.back() != NULL_NODE && (answered.empty() || !refineFrom(results[answered.back().query], answered.back().complete, query, words))) {
+                int remaining = wordLimit + (extended ? 1 : 0);
+                auto collect = [&words](const string& word) {
+                    words.push_back(word);
+                };
+
+                scratch = query;
+                if (remaining > 0) visitHelper(pool.get(path.back()), scratch, remaining, collect);
+                complete = remaining > 0;
+            }
+
+            if (extended) answered.push_back({ order[k], complete });
+        }
+
+        while (!answered.empty()) leave();
+    }
+
+    // Fill the deletion index with every word, after a bulk load changed the nodes directly
+    void rebuildDeletionIndex() {
+        vector<string> words;
+        string scratch;
+        int remaining = INT_MAX;
+        auto collect = [&words](const string& word) {
+            words.push_back(word);
+        };
+
+        visitHelper(pool.get(root), scratch, remaining, collect);
+        deletionIndex->build(words);
+    }
+
+    // Same walk as suggestHelper, but the words are handed to the visitor instead of being
+    // copied into a list. "remaining" counts down the words still wanted
+    template <typename Visitor>
+    void visitHelper(TrieNode* currentNode, string& currentWord, int& remaining, Visitor& visit) {
+        if (currentNode->isEndOfWord) {
+            visit(static_cast<const string&>(currentWord));
+            remaining--;
+        }
+
+        for (uint32_t bits = currentNode->childMask; bits && remaining > 0; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+
+            currentWord.push_back('a' + i);
+            visitHelper(child(currentNode, i), currentWord, remaining, visit);
+            currentWord.pop_back();
+        }
+    }
+
+    // Same walk as searchByRegex, handing the words to the visitor
+    template <typename Visitor>
+    void visitByRegex(TrieNode* currentNode, RegexAutomaton& regex, int state, string& currentWord, int& remaining, Visitor& visit) {
+        if (regex.accepting(state) && currentNode->isEndOfWord) {
+            visit(static_cast<const string&>(currentWord));
+            remaining--;
+        }
+
+        for (uint32_t bits = currentNode->childMask & regex.letters(state); bits && remaining > 0; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+            int next = regex.step(state, 'a' + i);
+
+            if (next == RegexAutomaton::DEAD) continue;
+
+            currentWord.push_back('a' + i);
+            visitByRegex(child(currentNode, i), regex, next, currentWord, remaining, visit);
+            currentWord.pop_back();
+        }
+    }
+
+    // Expand a prefix taken from the queue of fuzzySearchBestFirst at distance "bound". Every
+    // entry left in the queue is further or comes after all the words below the prefix, so
+    // the descendants that keep the bound are visited right away in alphabetical order and
+    // their words at that distance reported. Only the others go into the queue.
+    // Returns false once the results are full
+    bool bestFirstHelper(TrieNode* node, LevenshteinAutomaton& automaton, int state, int bound, string& currentWord,
+        priority_queue<FuzzyEntry, vector<FuzzyEntry>, greater<FuzzyEntry>>& frontier, vector<string>& results, int wordLimit) {
+
+        for (uint32_t bits = node->childMask; bits; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+            int next = automaton.step(state, 'a' + i);
+
+            if (next == LevenshteinAutomaton::DEAD) continue;
+
+            uint32_t childIndex = pool.getChild(node, i);
+            TrieNode* childNode = pool.get(childIndex);
+            int distance = automaton.distance(next);
+            bool searching = true;
+
+            currentWord.push_back('a' + i);
+
+            if (childNode->isEndOfWord && distance <= automaton.getMaxDistance()) {
+                if (distance == bound) {
+                    results.push_back(currentWord);
+                    if (results.size() >= (size_t)wordLimit) return false;
+                }
+                else {
+                    frontier.push({ distance, true, currentWord, childIndex, next });
+                }
+            }
+
+            if (childNode->childMask) {
+                if (automaton.lowerBound(next) == bound) searching = bestFirstHelper(childNode, automaton, next, bound, currentWord, frontier, results, wordLimit);
+                else frontier.push({ automaton.lowerBound(next), false, currentWord, childIndex, next });
+            }
+
+            currentWord.pop_back();
+            if (!searching) return false;
+        }
+
+        return true;
+    }
+
+    void fuzzyAutomatonHelper(TrieNode* node, LevenshteinAutomaton& automaton, int state, string& currentWord,
+        vector<vector<string>>& byDistance, int wordLimit) {
+
+        for (uint32_t bits = node->childMask; bits; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+            int next = automaton.step(state, 'a' + i);
+
+            // No word below this child is close enough to the query
+            if (next == LevenshteinAutomaton::DEAD) continue;
+
+            TrieNode* childNode = child(node, i);
+            int distance = automaton.distance(next);
+
+            currentWord.push_back('a' + i);
+
+            if (childNode->isEndOfWord && distance <= automaton.getMaxDistance() && byDistance[distance].size() < (size_t)wordLimit) {
+                byDistance[distance].push_back(currentWord);
+            }
+
+            fuzzyAutomatonHelper(childNode, automaton, next, currentWord, byDistance, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    // "columns" holds one kernel column per letter of the current word, the column of the
+    // node is at "depth"
+    void fuzzyBitParallelHelper(TrieNode* node, const EditDistanceKernel& kernel, vector<uint64_t>& columns, int depth, int distance,
+        string& currentWord, int maxDistance, vector<vector<string>>& byDistance, int wordLimit) {
+
+        int stride = kernel.stride();
+        if (columns.size() < (size_t)((depth + 2) * stride)) columns.resize((depth + 2) * stride);
+
+        const uint64_t* column = &columns[depth * stride];
+        uint64_t* next = &columns[(depth + 1) * stride];
+        char last = depth > 0 ? currentWord.back() : 0;
+
+        for (uint32_t bits = node->childMask; bits; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+            int childDistance = kernel.step(column, last, 'a' + i, next, distance);
+
+            // Nothing below is close enough, and neither is the child itself. Checked before
+            // the child is loaded, since that is the expensive part of an edge
+            if (!kernel.withinReach(next, depth + 1, maxDistance)) continue;
+
+            TrieNode* childNode = child(node, i);
+            currentWord.push_back('a' + i);
+
+            if (childNode->isEndOfWord && childDistance <= maxDistance && byDistance[childDistance].size() < (size_t)wordLimit) {
+                byDistance[childDistance].push_back(currentWord);
+            }
+
+            // The buffer may grow below, so the columns are looked up again afterwards
+            fuzzyBitParallelHelper(childNode, kernel, columns, depth + 1, childDistance, currentWord, maxDistance, byDistance, wordLimit);
+            column = &columns[depth * stride];
+            next = &columns[(depth + 1) * stride];
+
+            currentWord.pop_back();
+        }
+    }
+
+    // Walk the trie and the regex automaton in lockstep. Only the children whose letter the
+    // automaton can read next are visited, so subtrees no match can go through are skipped
+    void searchByRegex(vector<string>& results, RegexAutomaton& regex, int state, TrieNode* currentNode, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        // If the node ends a word and the automaton accepts here, the whole word matches
+        if (regex.accepting(state) && currentNode->isEndOfWord) {
+            results.push_back(currentWord);
+        }
+
+        for (uint32_t bits = currentNode->childMask & regex.letters(state); bits; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+            int next = regex.step(state, 'a' + i);
+
+            if (next == RegexAutomaton::DEAD) continue;
+
+            currentWord.push_back('a' + i);
+            searchByRegex(results, regex, next, child(currentNode, i), currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void fuzzySearchHelper(TrieNode* node, string& query, int maxDistance,
+        const vector<int>& previousRow, string currentWord, vector<pair<string, int>>& results) {
+
+        char nodeChar = currentWord.back();
+        int numCols = query.size() + 1;
+        vector<int> currentRow(numCols);
+
+        // Update DP table for this character
+
+        // The first entry in the current row is always the previous row's first entry + 1.
+        // Think of a 2D matrix where the first row is the query and the first column is the word. 
+        // Each cell represents the minimum number of operations to convert the prefix of the word to the prefix of the query.
+        currentRow[0] = previousRow[0] + 1;
+
+        // Assume that "i" is character index in the query string, and "j" is character index in the node string
+        // "w1" is the query string, "w2" is the node string.
+        // We start from (1,1) since (0,0) is already initialized (considering empty string).
+        for (int col = 1; col < numCols; col++) {
+            // In the insertion case, we try to insert a character at w2[j] to match w1[i-1] (which is just before the current character of w1)
+            // This makes the character at w2[j] equal to w1[i-1], so we can shift i-1 to i and it costs 1 operation.
+            int insertCost = currentRow[col - 1] + 1;
+
+            // In the deletion case, we try to delete a character at w1[i] and shift to w1[i+1] to match w2[j].
+            // Similar to the insertion case, we shift i to i+1 and it costs 1 operation.
+            int deleteCost = previousRow[col] + 1;
+
+            // In the replacement case, we try to replace the character at w2[j] with w1[i] to make them equal.
+            // If two characters are already equal, it costs 0 operation. Otherwise, it costs 1 operation.
+            int replaceCost = previousRow[col - 1] + (query[col - 1] != nodeChar ? 1 : 0);
+
+            // Final cost is the minimum of the three operations
+            currentRow[col] = min({ insertCost, deleteCost, replaceCost });
+        }
+
+        // If the last entry in the current row is within maxDistance and the node is a word, add it to the list
+        if (currentRow.back() <= maxDistance && node->isEndOfWord) {
+            results.push_back({ currentWord, currentRow.back() });
+        }
+
+        // Prune paths where the minimum edit distance exceeds maxDistance
+        if (*min_element(currentRow.begin(), currentRow.end()) > maxDistance) {
+            return;
+        }
+
+        // Recurse to children
+        for (uint32_t bits = node->childMask; bits; bits &= bits - 1) {
+            int i = countTrailingZeros(bits);
+
+            currentWord.push_back('a' + i);
+            fuzzySearchHelper(child(node, i), query, maxDistance, currentRow, currentWord, results);
+            currentWord.pop_back();
+        }
+    }
+public:
+    int comparisons;
+
+    // Fuzzy distances are capped at this or the query length, see cappedDistance()
+    static const int MAX_FUZZY_DISTANCE = 255;
+
+    Trie() : enableLogging(true), enableCaching(true), concurrentReads(false), maxCachedDistance(0), deletionIndex(nullptr), version(0), comparisons(0) {
+        root = pool.allocate();
+        cache = new CacheManager(10);
+    }
+
+    void setLogging(bool enable) {
+		enableLogging = enable;
+		cache->setLogging(enable);
+    }
+
+    void setCaching(bool enable) {
+        enableCaching = enable;
+    }
+
+    // Replace the cache with an empty one. More shards let more threads use it at once,
+    // the capacity is split evenly between them
+    void setCacheCapacity(size_t capacity, int shardCount = 1) {
+        delete cache;
+        cache = new CacheManager(capacity, shardCount);
+        cache->setLogging(enableLogging);
+    }
+
+    // Build a deletion index of the words for fuzzy searches within maxDistance, or drop it
+    // with 0. fuzzySearch answers the queries within the distance from the index instead of
+    // walking the trie, and the index follows every insert and remove from then on. Like
+    // setCacheCapacity, no operation may be running while the index is replaced
+    void setDeletionIndex(int maxDistance) {
+        delete deletionIndex;
+        deletionIndex = nullptr;
+
+        if (maxDistance <= 0) return;
+
+        deletionIndex = new DeletionIndex(maxDistance);
+        rebuildDeletionIndex();
+    }
+
+    // In concurrent mode suggest, suggestRanked, fuzzySearch and contains can run on any
+    // number of threads while insert, remove and setScore are called from others. Readers
+    // take no lock: writers copy the path they change and publish a new root, and the old
+    // nodes are released once no reader can be traversing them. Give the cache several
+    // shards with setCacheCapacity() when many threads read at once. Switch the mode on
+    // after the initial load, the bulk loaders and releaseTrie still change nodes in
+    // place, and no operation may be running while the mode is switched
+    void setConcurrentReads(bool enable) {
+        if (!enable) epochs.drain(pool);
+        concurrentReads = enable;
+    }
+
+    bool contains(const string& word) {
+        ReadGuard guard(epochs, concurrentReads);
+        TrieNode* node = searchPrefix(word);
+
+        return node != nullptr && node->isEndOfWord;
+    }
+
+    void loadDictionary(const string& filename) {
+        ifstream ifile(filename);
+        string word;
+
+        if (!ifile.is_open()) {
+			if (enableLogging) log("[Trie]: Error opening file", RED);
+            return;
+        }
+
+        if (enableLogging) log("Loading dictionary...", YELLOW);
+        while (getline(ifile, word)) {
+            // Assume that the word has no leading and trailing spaces
+            long long score = splitScore(word);
+            if (word.empty()) continue;
+
+            if (score < 0) insert(word);
+            else insert(word, (uint32_t)score);
+        }
+
+        if (enableLogging) log("[Trie]: Dictionary loaded successfully", GREEN);
+
+        ifile.close();
+    }
+
+    // Same as loadDictionary, but words are sharded by their first two letters and every
+    // worker builds whole subtrees in a private pool. The pools are then rebased onto the
+    // trie pool and the subtrees stitched under the root, so the workers never share a node
+    void loadDictionaryParallel(const string& filename, unsigned threadCount = 0) {
+        const int SHARDS = 26 * 26;
+
+        ifstream ifile(filename);
+        string word;
+
+        if (!ifile.is_open()) {
+            if (enableLogging) log("[Trie]: Error opening file", RED);
+            return;
+        }
+
+        if (threadCount == 0) threadCount = max(1u, thread::hardware_concurrency());
+
+        // A shard whose subtree already exists has to be merged word by word
+        TrieNode* rootNode = pool.get(root);
+        vector<bool> occupied(SHARDS, false);
+
+        for (int first = 0; first < 26; first++) {
+            uint32_t level1 = pool.getChild(rootNode, first);
+            if (level1 == NULL_NODE) continue;
+
+            for (int second = 0; second < 26; second++) {
+                occupied[first * 26 + second] = pool.getChild(pool.get(level1), second) != NULL_NODE;
+            }
+        }
+
+        if (enableLogging) log("Loading dictionary...", YELLOW);
+
+        // Words are kept with their score, or -1 if the line had none
+        vector<vector<pair<string, long long>>> shards(SHARDS);
+        vector<size_t> shardLetters(SHARDS, 0);
+        vector<bool> shardScored(SHARDS, false);
+        vector<pair<string, long long>> serialWords;
+
+        while (getline(ifile, word)) {
+            // Assume that the word has no leading and trailing spaces
+            long long score = splitScore(word);
+            if (word.empty()) continue;
+
+            int shard = -1;
+            if (word.size() >= 2 && word[0] >= 'a' && word[0] <= 'z' && word[1] >= 'a' && word[1] <= 'z') {
+                shard = (word[0] - 'a') * 26 + (word[1] - 'a');
+            }
+
+            if (shard < 0 || occupied[shard]) {
+                serialWords.push_back({ move(word), score });
+                continue;
+            }
+
+            shardLetters[shard] += word.size();
+            shardScored[shard] = shardScored[shard] || score >= 0;
+            shards[shard].push_back({ move(word), score });
+        }
+
+        ifile.close();
+
+        // Hand out the biggest shards first, always to the least loaded worker
+        vector<int> order;
+        for (int shard = 0; shard < SHARDS; shard++) {
+            if (!shards[shard].empty()) order.push_back(shard);
+        }
+        sort(order.begin(), order.end(), [&](int a, int b) {
+            return shardLetters[a] > shardLetters[b];
+            });
+
+        threadCount = (unsigned)max<size_t>(1, min<size_t>(threadCount, order.size()));
+        vector<vector<int>> assigned(threadCount);
+        vector<size_t> load(threadCount, 0);
+
+        for (int shard : order) {
+            size_t worker = min_element(load.begin(), load.end()) - load.begin();
+            assigned[worker].push_back(shard);
+            load[worker] += shardLetters[shard];
+        }
+
+        vector<NodePool> pools(threadCount);
+        vector<uint32_t> subroots(SHARDS, NULL_NODE);
+        vector<uint32_t> offsets(threadCount);
+        vector<thread> workers;
+
+        for (unsigned t = 0; t < threadCount; t++) {
+            workers.emplace_back([&, t]() {
+                for (int shard : assigned[t]) {
+                    uint32_t subroot = pools[t].allocate();
+
+                    for (const auto& entry : shards[shard]) {
+                        uint32_t end = insertInto(pools[t], subroot, entry.first, 2);
+                        if (entry.second >= 0) pools[t].get(end)->score = (uint32_t)entry.second;
+                    }
+
+                    if (shardScored[shard]) computeMaxScores(pools[t], subroot);
+                    subroots[shard] = subroot;
+                }
+                });
+        }
+        for (thread& worker : workers) worker.join();
+        workers.clear();
+
+        // Each pool lands after the slabs of the trie and of the pools before it, so the
+        // rebasing is independent per pool and runs in parallel as well
+        size_t nodeSlabs = pool.slabCount();
+        size_t slotSlabs = pool.arenaSlabCount();
+
+        for (unsigned t = 0; t < threadCount; t++) {
+            workers.emplace_back([&pools, &offsets, t, nodeSlabs, slotSlabs]() {
+                offsets[t] = pools[t].rebase(nodeSlabs, slotSlabs);
+                });
+
+            nodeSlabs += pools[t].slabCount();
+            slotSlabs += pools[t].arenaSlabCount();
+        }
+        for (thread& worker : workers) worker.join();
+
+        // All pools are adopted before stitching, since the stitching allocates nodes and
+        // child blocks that could start a new slab and move the pools that come after
+        for (unsigned t = 0; t < threadCount; t++) {
+            pool.adopt(pools[t]);
+        }
+
+        for (unsigned t = 0; t < threadCount; t++) {
+            for (int shard : assigned[t]) {
+                int first = shard / 26;
+                uint32_t level1 = pool.getChild(rootNode, first);
+
+                if (level1 == NULL_NODE) {
+                    level1 = pool.allocate();
+                    pool.addChild(rootNode, first, level1);
+                }
+
+                pool.addChild(pool.get(level1), shard % 26, subroots[shard] + offsets[t]);
+            }
+        }
+
+        // Carry the best scores of the stitched subtrees up to the root
+        for (int first = 0; first < 26; first++) {
+            uint32_t level1 = pool.getChild(rootNode, first);
+            if (level1 != NULL_NODE) refreshMaxScore(pool, pool.get(level1));
+        }
+        refreshMaxScore(pool, rootNode);
+
+        for (const auto& entry : serialWords) {
+            uint32_t end = insertInto(pool, root, entry.first, 0);
+
+            if (entry.second >= 0) {
+                pool.get(end)->score = (uint32_t)entry.second;
+                refreshPath(entry.first);
+            }
+        }
+
+        // Cached results are dropped once instead of invalidating them for every word
+        version++;
+        cache->clearCache();
+        if (deletionIndex) rebuildDeletionIndex();
+
+        if (enableLogging) log("[Trie]: Dictionary loaded successfully", GREEN);
+    }
+
+    // Bulk load words sorted in byte order. Only the path of the previous word is kept: a
+    // word shares its first "common" letters with it, so the path is cut back there and
+    // extended with the rest. Starting from an empty trie new children always come last,
+    // so nothing is shifted and the total work is linear in the number of letters.
+    // The order is checked in a first pass over the range, which has to be a forward range.
+    // Returns false and leaves the trie untouched if a word is out of order
+    template <typename Iterator>
+    bool buildFromSorted(Iterator first, Iterator last) {
+        Iterator previousWord = last;
+
+        for (Iterator it = first; it != last; ++it) {
+            const string& word = *it;
+            if (word.empty()) continue;
+
+            if (previousWord != last && lexicographical_compare(word.begin(), word.end(), previousWord->begin(), previousWord->end(),
+                [](char a, char b) { return (unsigned char)a < (unsigned char)b; })) {
+                if (enableLogging) log("[Trie]: Input is not sorted at \"" + word + "\"", RED);
+                return false;
+            }
+
+            previousWord = it;
+        }
+
+        vector<uint32_t> path = { root };
+        string previous;
+
+        for (Iterator it = first; it != last; ++it) {
+            const string& word = *it;
+            if (word.empty()) continue;
+
+            size_t common = 0;
+            size_t limit = min(word.size(), previous.size());
+            while (common < limit && word[common] == previous[common]) common++;
+
+            path.resize(common + 1);
+
+            for (size_t k = common; k < word.size(); k++) {
+                TrieNode* parent = pool.get(path.back());
+                int idx = word[k] - 'a';
+                uint32_t next = pool.getChild(parent, idx);
+
+                // The trie may already hold other words, reuse their nodes
+                if (next == NULL_NODE) {
+                    next = pool.allocate();
+                    pool.addChild(parent, idx, next);
+                }
+
+                path.push_back(next);
+            }
+
+            pool.get(path.back())->isEndOfWord = true;
+            previous = word;
+        }
+
+        // Cached results are dropped once instead of invalidating them for every word
+        version++;
+        cache->clearCache();
+        if (deletionIndex) rebuildDeletionIndex();
+
+        return true;
+    }
+
+    bool isEmpty(TrieNode* current) {
+        return current->childMask == 0;
+    }
+
+    // Number of nodes currently allocated in the pool, including the root
+    size_t getNodeCount() {
+        return pool.size();
+    }
+
+    // Bytes reserved by the node pool
+    size_t getMemoryUsage() {
+        return pool.memoryUsage();
+    }
+
+    // Number of entries in the suggestion cache
+    size_t getCacheSize() {
+        return cache->getSize();
+    }
+
+    // Insert a word with a score, or change the score if the word is already in the trie
+    void insert(const string& word, uint32_t score) {
+        if (concurrentReads) {
+            lock_guard<mutex> lock(writeLock);
+
+            insertConcurrent(word, true, score);
+            invalidateCache(word);
+            if (deletionIndex) deletionIndex->insert(word);
+            return;
+        }
+
+        pool.get(insertInto(pool, root, word, 0))->score = score;
+        refreshPath(word);
+
+        version++;
+        invalidateCache(word);
+        if (deletionIndex) deletionIndex->insert(word);
+    }
+
+    bool setScore(const string& word, uint32_t score) {
+        unique_lock<mutex> lock(writeLock, defer_lock);
+        if (concurrentReads) lock.lock();
+
+        TrieNode* current = searchPrefix(word);
+
+        if (current == nullptr || !current->isEndOfWord) {
+            if (enableLogging) log("[Trie]: Word \"" + word + "\" not found", RED);
+            return false;
+        }
+
+        if (concurrentReads) {
+            insertConcurrent(word, true, score);
+            return true;
+        }
+
+        current->score = score;
+        refreshPath(word);
+
+        return true;
+    }
+
+    void insert(const string& word) {
+        if (concurrentReads) {
+            lock_guard<mutex> lock(writeLock);
+
+            insertConcurrent(word, false, 0);
+            invalidateCache(word);
+            if (deletionIndex) deletionIndex->insert(word);
+            return;
+        }
+
+        insertInto(pool, root, word, 0);
+        version++;
+
+        // Update the cache by removing the entries whose suggestions may change with the inserted word.
+        // This is more efficient because the prefix will only be updated when it is searched again.
+        // So there is no need to update all the cache immediately after inserting the word.
+        invalidateCache(word);
+        if (deletionIndex) deletionIndex->insert(word);
+
+        //log("Inserted word " + word, GREEN);
+    }
+
+    TrieNode* searchPrefix(const string& word) {
+        TrieNode* current = pool.get(root);
+
+        for (auto& c : word) {
+			countComparison();
+            // If the word being searched is longer than an existing word
+            countComparison();
+            uint32_t next = pool.getChild(current, c - 'a');
+            if (next == NULL_NODE) {
+                return nullptr;
+            }
+
+            current = pool.get(next);
+        }
+		countComparison();
+
+        // If the word being searched exists in trie, there is no need to traverse further
         return current;
     }
 
-    void remove(const string& word) {
-        removeHelper(word, root, 0);
+    void remove(const string& word) {
+        if (concurrentReads) {
+            lock_guard<mutex> lock(writeLock);
+
+            removeConcurrent(word);
+            invalidateCache(word);
+            if (deletionIndex) deletionIndex->remove(word);
+            return;
+        }
+
+        removeHelper(word, root, 0);
+        refreshPath(word);
+        version++;
+
+        // The principle is similar to insertion
+        invalidateCache(word);
+        if (deletionIndex) deletionIndex->remove(word);
+
+        // log("[Trie]: Removed word \"" + word + "\"", RED);
+    }
+
+    // Suggestions ordered by score, ties in alphabetical order. Subtrees are expanded best
+    // first by their best score, so only the nodes on the way to the reported words and
+    // their siblings are visited instead of the whole subtree of the prefix
+    vector<string> suggestRanked(const string& prefix, int wordLimit = 10) {
+        ReadGuard guard(epochs, concurrentReads);
+        vector<string> results;
+        TrieNode* start = searchPrefix(prefix);
+
+        if (start == nullptr) return results;
+
+        priority_queue<RankedEntry, vector<RankedEntry>, RankedOrder> queue;
+        queue.push({ start->maxScore, prefix, start, false });
+
+        while (!queue.empty() && results.size() < (size_t)wordLimit) {
+            RankedEntry top = queue.top();
+            queue.pop();
+
+            if (top.isWord) {
+                results.push_back(top.word);
+                continue;
+            }
+
+            TrieNode* node = top.node;
+            if (node->isEndOfWord) queue.push({ node->score, top.word, node, true });
+
+            for (uint32_t bits = node->childMask; bits; bits &= bits - 1) {
+                int i = countTrailingZeros(bits);
+                TrieNode* next = pool.get(pool.getChild(node, i));
+
+                countComparison();
+                queue.push({ next->maxScore, top.word + (char)('a' + i), next, false });
+            }
+        }
+
+        return results;
+    }
+
+    // Stream up to wordLimit suggestions of a prefix or a regex to visit(const string& word),
+    // in alphabetical order, and return how many were visited. The word handed over is
+    // "scratch", the path buffer of the search, so copy it to keep it. Nothing is allocated
+    // once the buffer has grown to the longest word, apart from compiling a regex.
+    // The cache is bypassed, as storing or copying cached lists would allocate
+    template <typename Visitor>
+    int visitSuggestions(const string& prefix, int wordLimit, string& scratch, Visitor visit) {
+        ReadGuard guard(epochs, concurrentReads);
+        int remaining = wordLimit;
+
+        scratch.clear();
+
+        if (!hasWildcard(prefix)) {
+            TrieNode* currentNode = searchPrefix(prefix);
+
+            if (currentNode && remaining > 0) {
+                scratch.append(prefix);
+                visitHelper(currentNode, scratch, remaining, visit);
+            }
+        }
+        else {
+            RegexAutomaton regex;
+
+            if (!regex.compile(prefix)) {
+                if (enableLogging) log("[Trie]: Invalid regex: " + prefix, RED);
+            }
+            else if (remaining > 0 && regex.start() != RegexAutomaton::DEAD) {
+                visitByRegex(pool.get(root), regex, regex.start(), scratch, remaining, visit);
+            }
+        }
+
+        return wordLimit - remaining;
+    }
+
+    // Same as visitSuggestions, with the words written one after another into "out"
+    int suggestInto(const string& prefix, int wordLimit, SuggestionBuffer& out) {
+        out.clear();
+        return visitSuggestions(prefix, wordLimit, out.path, [&out](const string& word) { out.append(word); });
+    }
+
+    vector<string> suggest(const string& prefix, int wordLimit = 10) {
+        ReadGuard guard(epochs, concurrentReads);
+
+        // Check if the prefix is in the cache. Turn caching off to measure the trie alone
+        bool isRegex = hasWildcard(prefix);
+        string cacheKey = (isRegex ? "r" : "p") + prefix;
+        uint64_t cacheGeneration = cache->getGeneration();
+
+        if (enableCaching) {
+            vector<string> cachedSuggestions;
+            if (cache->get(cacheKey, wordLimit, cachedSuggestions)) {
+                if (enableLogging) log("[Trie]: Found prefix \"" + prefix + "\" in cache", YELLOW);
+                return cachedSuggestions;
+            }
+        }
+
+        // If the prefix is not in the cache, search the trie
+        vector<string> results;
+        int cacheGroup = -1;
+        function<bool(const string&)> affectedBy;
+
+        // If the prefix is not a regex, search the trie as usual
+        if (!isRegex) {
+            TrieNode* currentNode = searchPrefix(prefix);
+
+			countComparison();
+            if (currentNode) {
+                string currentWord = prefix;
+                suggestHelper(results, currentNode, currentWord, wordLimit);
+            }
+
+            // Otherwise, search the trie by regex
+        }
+        else {
+            shared_ptr<RegexAutomaton> regex = make_shared<RegexAutomaton>();
+            string currentWord = "";
+
+            if (!regex->compile(prefix)) {
+                if (enableLogging) log("[Trie]: Invalid regex: " + prefix, RED);
+            }
+            else if (regex->start() != RegexAutomaton::DEAD) {
+                searchByRegex(results, *regex, regex->start(), pool.get(root), currentWord, wordLimit);
+            }
+
+            // A regex entry is grouped by the length of the words it matches, and keeps its
+            // automaton so that a write is checked without compiling the regex again. Writes
+            // hold the write lock, so the automaton is never stepped by two threads at once
+            cacheGroup = regexGroup(regex->fixedLength());
+            affectedBy = [regex](const string& word) { return regex->matches(word); };
+        }
+
+        // Update the cache, unless a write invalidated it while the trie was searched
+        if (enableCaching) cache->insert(cacheKey, results, cacheGeneration, cacheGroup, affectedBy);
+
+        return results;
+    }
+
+    // Suggestions for many prefixes at once, in the order of the queries. The queries are
+    // sorted so that the ones sharing letters come together: the shared part of their path
+    // is walked once, and a query extending an earlier one filters its list when the list
+    // holds all its words. With several threads each takes a contiguous run of the sorted
+    // queries. Plain prefixes skip the cache, regex queries go through suggest one by one
+    // and read and fill it like any other suggest call. On one thread a batch is only a
+    // little faster than suggest with caching off, as unrelated prefixes share little
+    vector<vector<string>> suggestBatch(const vector<string>& queries, int wordLimit = 10, unsigned threadCount = 1) {
+        vector<vector<string>> results(queries.size());
+        vector<pair<uint64_t, size_t>> keyed;
+        vector<size_t> order;
+
+        wordLimit = max(wordLimit, 0);
+        for (size_t i = 0; i < queries.size(); i++) {
+            if (hasWildcard(queries[i])) results[i] = suggest(queries[i], wordLimit);
+            else keyed.push_back({ sortKey(queries[i]), i });
+        }
+
+        // Most queries differ in their first 8 bytes, so the strings are rarely compared
+        sort(keyed.begin(), keyed.end(), [&queries](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) {
+            return a.first != b.first ? a.first < b.first : queries[a.second] < queries[b.second];
+            });
+
+        order.reserve(keyed.size());
+        for (const auto& query : keyed) order.push_back(query.second);
+
+        // Small runs are not worth a thread
+        if (threadCount == 0) threadCount = max(1u, thread::hardware_concurrency());
+        threadCount = (unsigned)max<size_t>(1, min<size_t>(threadCount, order.size() / 256));
+
+        size_t chunk = (order.size() + threadCount - 1) / threadCount;
+        vector<thread> workers;
+
+        for (unsigned t = 1; t < threadCount; t++) {
+            workers.emplace_back([&, t]() {
+                suggestBatchRange(queries, order, min(order.size(), t * chunk), min(order.size(), (t + 1) * chunk), wordLimit, results);
+                });
+        }
+        suggestBatchRange(queries, order, 0, min(order.size(), chunk), wordLimit, results);
+
+        for (thread& worker : workers) worker.join();
+
+        return results;
+    }
+
+    vector<string> fuzzySearch(string& query, int maxDistance = 1, int wordLimit = 10) {
+        ReadGuard guard(epochs, concurrentReads);
+        maxDistance = cappedDistance(query, maxDistance);
+
+        // Check if the query is in the cache
+        string cacheKey = "f" + to_string(maxDistance) + ":" + query;
+        uint64_t cacheGeneration = cache->getGeneration();
+
+        if (enableCaching) {
+            vector<string> cachedSuggestions;
+            if (cache->get(cacheKey, wordLimit, cachedSuggestions)) {
+                if (enableLogging) log("[Trie]: Found query \"" + query + "\" in cache", YELLOW);
+                return cachedSuggestions;
+            }
+        }
+
+        // Within the distance of the deletion index, candidates come from the index instead
+        vector<string> finalResults;
+        if (deletionIndex != nullptr && maxDistance <= deletionIndex->getMaxDistance()) {
+            finalResults = deletionIndex->search(query, maxDistance, wordLimit);
+        }
+        else {
+            // Otherwise search the trie
+            vector<pair<string, int>> results;
+            vector<int> currentRow(query.size() + 1);
+
+            // Initialize the first row of the DP table. The query starts from index 1 since index 0 represents an empty string.
+            for (size_t i = 0; i <= query.size(); ++i) {
+                currentRow[i] = i;
+            }
+
+            // Start recursive fuzzy matching
+            string currentWord = "";
+            TrieNode* rootNode = pool.get(root);
+            for (uint32_t bits = rootNode->childMask; bits; bits &= bits - 1) {
+                int i = countTrailingZeros(bits);
+
+                currentWord.push_back('a' + i);
+                fuzzySearchHelper(child(rootNode, i), query, maxDistance, currentRow, currentWord, results);
+                currentWord.pop_back();
+            }
+
+            // Sort the results by Levenshtein distance. Words at the same distance stay in alphabetical order
+            stable_sort(results.begin(), results.end(), [](const pair<string, int>& a, const pair<string, int>& b) {
+                return a.second < b.second;
+                });
+
+            // Resize the results to the word limit
+            for (int i = 0; i < (int)results.size() && i < wordLimit; i++) {
+                finalResults.push_back(results[i].first);
+            }
+        }
+
+        // Update the cache, grouped by the query length so that a write only checks the queries
+        // that are close enough in length to match the word
+        if (enableCaching) {
+            if (maxDistance > maxCachedDistance) maxCachedDistance = maxDistance;
+            cache->insert(cacheKey, finalResults, cacheGeneration, fuzzyGroup((int)query.size()), fuzzyMatcher(query, maxDistance));
+        }
+
+        return finalResults;
+    }
+
+    // Same results as fuzzySearch, found by walking the trie with a Levenshtein automaton of
+    // the query. Most edges reuse a transition computed for another branch, so the rows
+    // are not computed again for every node. fuzzySearch stays as the reference
+    vector<string> fuzzySearchAutomaton(const string& query, int maxDistance = 1, int wordLimit = 10) {
+        ReadGuard guard(epochs, concurrentReads);
+        maxDistance = cappedDistance(query, maxDistance);
+
+        // The results are the same as fuzzySearch, so the cache entries are shared
+        string cacheKey = "f" + to_string(maxDistance) + ":" + query;
+        uint64_t cacheGeneration = cache->getGeneration();
+
+        if (enableCaching) {
+            vector<string> cachedSuggestions;
+            if (cache->get(cacheKey, wordLimit, cachedSuggestions)) {
+                if (enableLogging) log("[Trie]: Found query \"" + query + "\" in cache", YELLOW);
+                return cachedSuggestions;
+            }
+        }
+
+        // One list per distance, filled in alphabetical order. Only the first wordLimit words
+        // of a distance can make it into the results
+        vector<vector<string>> byDistance(max(maxDistance, 0) + 1);
+        LevenshteinAutomaton automaton(query, maxDistance);
+        string currentWord;
+
+        if (maxDistance >= 0) fuzzyAutomatonHelper(pool.get(root), automaton, automaton.start(), currentWord, byDistance, wordLimit);
+
+        vector<string> finalResults;
+        for (auto& words : byDistance) {
+            for (size_t i = 0; i < words.size() && finalResults.size() < (size_t)wordLimit; i++) {
+                finalResults.push_back(words[i]);
+            }
+        }
+
+        if (enableCaching) {
+            if (maxDistance > maxCachedDistance) maxCachedDistance = maxDistance;
+            cache->insert(cacheKey, finalResults, cacheGeneration, fuzzyGroup((int)query.size()), fuzzyMatcher(query, maxDistance));
+        }
+
+        return finalResults;
+    }
+
+    // Same results as fuzzySearch, found best first. Prefixes wait in a priority queue ordered
+    // by the lowest distance any word below them can have, and words by their distance, with
+    // ties in alphabetical order. Words therefore come out in the final order and the search
+    // stops at the wordLimit-th, without expanding the prefixes that can only lead further
+    vector<string> fuzzySearchBestFirst(const string& query, int maxDistance = 1, int wordLimit = 10) {
+        ReadGuard guard(epochs, concurrentReads);
+        maxDistance = cappedDistance(query, maxDistance);
+
+        // The results are the same as fuzzySearch, so the cache entries are shared
+        string cacheKey = "f" + to_string(maxDistance) + ":" + query;
+        uint64_t cacheGeneration = cache->getGeneration();
+
+        if (enableCaching) {
+            vector<string> cachedSuggestions;
+            if (cache->get(cacheKey, wordLimit, cachedSuggestions)) {
+                if (enableLogging) log("[Trie]: Found query \"" + query + "\" in cache", YELLOW);
+                return cachedSuggestions;
+            }
+        }
+
+        vector<string> finalResults;
+        LevenshteinAutomaton automaton(query, maxDistance);
+        priority_queue<FuzzyEntry, vector<FuzzyEntry>, greater<FuzzyEntry>> frontier;
+
+        if (maxDistance >= 0 && wordLimit > 0) frontier.push({ automaton.lowerBound(automaton.start()), false, "", root, automaton.start() });
+
+        while (!frontier.empty() && finalResults.size() < (size_t)wordLimit) {
+            FuzzyEntry entry = frontier.top();
+            frontier.pop();
+
+            if (entry.isWord) {
+                finalResults.push_back(entry.word);
+                continue;
+            }
+
+            bestFirstHelper(pool.get(entry.node), automaton, entry.state, entry.distance, entry.word, frontier, finalResults, wordLimit);
+        }
+
+        if (enableCaching) {
+            if (maxDistance > maxCachedDistance) maxCachedDistance = maxDistance;
+            cache->insert(cacheKey, finalResults, cacheGeneration, fuzzyGroup((int)query.size()), fuzzyMatcher(query, maxDistance));
+        }
+
+        return finalResults;
+    }
+
+    // Same results as fuzzySearch, with each trie edge handled by the bit-parallel kernel in a
+    // few word operations. With transpositions, swapping two adjacent letters counts as one
+    // edit, so "teh" is one away from "the" instead of two
+    vector<string> fuzzySearchBitParallel(const string& query, int maxDistance = 1, int wordLimit = 10, bool transpositions = false) {
+        ReadGuard guard(epochs, concurrentReads);
+        maxDistance = cappedDistance(query, maxDistance);
+
+        // Results with transpositions differ, so they are cached under their own keys
+        string cacheKey = "f" + to_string(maxDistance) + (transpositions ? "t" : "") + ":" + query;
+        uint64_t cacheGeneration = cache->getGeneration();
+
+        if (enableCaching) {
+            vector<string> cachedSuggestions;
+            if (cache->get(cacheKey, wordLimit, cachedSuggestions)) {
+                if (enableLogging) log("[Trie]: Found query \"" + query + "\" in cache", YELLOW);
+                return cachedSuggestions;
+            }
+        }
+
+        vector<vector<string>> byDistance(max(maxDistance, 0) + 1);
+        EditDistanceKernel kernel(query, transpositions);
+        vector<uint64_t> columns(kernel.stride() * 16);
+        string currentWord;
+
+        kernel.init(&columns[0]);
+        if (maxDistance >= 0) fuzzyBitParallelHelper(pool.get(root), kernel, columns, 0, query.size(), currentWord, maxDistance, byDistance, wordLimit);
+
+        vector<string> finalResults;
+        for (auto& words : byDistance) {
+            for (size_t i = 0; i < words.size() && finalResults.size() < (size_t)wordLimit; i++) {
+                finalResults.push_back(words[i]);
+            }
+        }
+
+        if (enableCaching) {
+            if (maxDistance > maxCachedDistance) maxCachedDistance = maxDistance;
+            cache->insert(cacheKey, finalResults, cacheGeneration, fuzzyGroup((int)query.size()), fuzzyMatcher(query, maxDistance, transpositions));
+        }
+
+        return finalResults;
+    }
+
+    // Convert the trie into an immutable LOUDS trie. The trie itself is left untouched
+    LoudsTrie freeze() {
+        LoudsTrie frozen;
+        vector<pair<uint32_t, char>> queue = { { root, 0 } };
+
+        // The vector doubles as the breadth-first queue
+        for (size_t head = 0; head < queue.size(); head++) {
+            TrieNode* node = pool.get(queue[head].first);
+
+            frozen.appendNode(queue[head].second, node->isEndOfWord, node->childMask);
+
+            for (uint32_t bits = node->childMask; bits; bits &= bits - 1) {
+                int i = countTrailingZeros(bits);
+                queue.push_back({ pool.getChild(node, i), (char)('a' + i) });
+            }
+        }
+
+        frozen.finish();
+
+        return frozen;
+    }
+
+    // Freeze the trie and write it as a snapshot for LoudsTrie::loadSnapshot()
+    bool saveSnapshot(const string& filename) {
+        LoudsTrie frozen = freeze();
+        frozen.setLogging(enableLogging);
+
+        return frozen.saveSnapshot(filename);
+    }
+
+    // Release every node by dropping the pool slabs, then start over with an empty root
+    void releaseTrie() {
+        epochs.clear();
+        pool.reset();
+        root = pool.allocate();
+        version++;
+        cache->clearCache();
+        if (deletionIndex) deletionIndex->clear();
+    }
+
+    ~Trie() {
+        delete cache;
+        delete deletionIndex;
+    }
+};
+
+const int Trie::MAX_FUZZY_DISTANCE;
+
+// Type-ahead state of one text field. Every keystroke moves a cursor one node down the trie
+// instead of walking the prefix again from the root, and the completions of the previous
+// prefix are filtered instead of searched again when they already hold every word of the
+// narrower subtree. Backspace goes back to the completions kept for the shorter prefix.
+// If the trie changed since the last keystroke, the cursor is found again from the root.
+// A session belongs to one thread, in concurrent mode the trie may be written meanwhile
+class CompletionSession {
+private:
+    struct Level {
+        // NULL_NODE once the prefix is not in the trie
+        uint32_t node;
+        vector<string> results;
+
+        // True if results hold every word below the node
+        bool complete;
+        bool computed;
+    };
+
+    Trie& trie;
+    int wordLimit;
+    string prefix;
+
+    // levels[i] is the state of the first i letters of the prefix
+    vector<Level> levels;
+    uint64_t version;
+
+    uint32_t childOf(uint32_t node, char c) {
+        if (node == NULL_NODE || c < 'a' || c > 'z') return NULL_NODE;
+        return trie.pool.getChild(trie.pool.get(node), c - 'a');
+    }
+
+    // Walk the prefix again from the current root and forget the completions
+    void resync() {
+        // The version is read first: a write after it is seen by the next keystroke
+        version = trie.version;
+        uint32_t node = trie.root;
+
+        levels.assign(1, { node, {}, false, false });
+        for (char c : prefix) {
+            node = childOf(node, c);
+            levels.push_back({ node, {}, false, false });
+        }
+    }
+
+    const vector<string>& refine() {
+        Level& level = levels.back();
+        if (level.computed) return level.results;
+
+        level.computed = true;
+        level.complete = true;
+        level.results.clear();
+
+        if (level.node == NULL_NODE) return level.results;
+
+        // The words of the prefix may all be in the list of the previous one
+        if (levels.size() > 1) {
+            const Level& parent = levels[levels.size() - 2];
+            if (parent.computed && Trie::refineFrom(parent.results, parent.complete, prefix, level.results)) return level.results;
+        }
+
+        // One extra word tells whether the subtree holds more than the limit
+        trie.suggestHelper(level.results, trie.pool.get(level.node), prefix, wordLimit + 1);
+
+        if (level.results.size() > (size_t)wordLimit) {
+            level.results.pop_back();
+            level.complete = false;
+        }
+
+        return level.results;
+    }
+
+public:
+    CompletionSession(Trie& trie, int wordLimit = 10) : trie(trie), wordLimit(wordLimit) {
+        resync();
+    }
+
+    const string& getPrefix() {
+        return prefix;
+    }
+
+    // Completions of the current prefix
+    const vector<string>& suggestions() {
+        Trie::ReadGuard guard(trie.epochs, trie.concurrentReads);
+
+        if (version != trie.version) resync();
+        return refine();
+    }
+
+    // Type a letter
+    const vector<string>& push(char c) {
+        Trie::ReadGuard guard(trie.epochs, trie.concurrentReads);
+
+        prefix.push_back(c);
+
+        if (version != trie.version) resync();
+        else levels.push_back({ childOf(levels.back().node, c), {}, false, false });
+
+        return refine();
+    }
+
+    // Erase the last letter
+    const vector<string>& pop() {
+        Trie::ReadGuard guard(trie.epochs, trie.concurrentReads);
+
+        if (!prefix.empty()) {
+            prefix.pop_back();
+            levels.pop_back();
+        }
+
+        if (version != trie.version) resync();
+        return refine();
+    }
+
+    // Start over with an empty prefix
+    void clear() {
+        prefix.clear();
+        levels.resize(1);
+    }
+};
+
+// Words starting with a prefix, pulled one at a time in alphabetical order. The walk keeps an
+// explicit stack of the nodes on the current path with the children still to visit, so it
+// stops as soon as the caller does. Its position is the last word returned: token() writes
+// it as "<prefix length>:<last word>", and an iterator built from the token goes down that
+// word only, skipping the children before it, so a page costs the same at any offset.
+// A word removed since the token was made still works as a position.
+// Plain prefixes only. Nodes are only read inside a call, so an idle iterator never holds
+// back the reclamation of a concurrent writer. If the trie changed since the last call, the
+// iterator goes down its last word again like a token would, and sees the changes after it
+class CompletionIterator {
+private:
+    struct Frame {
+        uint32_t node;
+
+        // Children not visited yet
+        uint32_t pending;
+    };
+
+    Trie& trie;
+    vector<Frame> stack;
+
+    // Version of the trie the stack was built on
+    uint64_t version;
+
+    // Letters of the current path, starting with the prefix
+    string word;
+    size_t prefixLength;
+
+    // True if the node at the top of the stack is a word that was not returned yet
+    bool pendingWord;
+    bool returned;
+
+    // Last word returned. The path in "word" is popped back to the prefix once the walk is over
+    string lastWord;
+
+    CompletionIterator(const CompletionIterator&);
+    CompletionIterator& operator=(const CompletionIterator&);
+
+    TrieNode* get(uint32_t node) {
+        return trie.pool.get(node);
+    }
+
+    // Put the node of the prefix on the stack, nothing if the prefix is missing
+    void start(const string& prefix) {
+        stack.clear();
+        pendingWord = false;
+        version = trie.version;
+
+        TrieNode* node = trie.searchPrefix(prefix);
+        if (node == nullptr) return;
+
+        uint32_t index = trie.root;
+        for (char c : prefix) index = trie.pool.getChild(get(index), c - 'a');
+
+        stack.push_back({ index, node->childMask });
+        pendingWord = node->isEndOfWord;
+    }
+
+    // Rebuild the stack on the current trie, right after the last word returned
+    void resync() {
+        // Nothing is left to return once the walk is over
+        if (stack.empty() && !pendingWord) {
+            version = trie.version;
+            return;
+        }
+
+        word.resize(prefixLength);
+        start(word);
+
+        if (returned && !stack.empty()) {
+            pendingWord = false;
+            seek(lastWord);
+        }
+    }
+
+    // Next word without checking the version of the trie
+    bool advance(string& out) {
+        if (pendingWord) {
+            pendingWord = false;
+            returned = true;
+            lastWord = out = word;
+            return true;
+        }
+
+        while (!stack.empty()) {
+            Frame& top = stack.back();
+
+            if (top.pending == 0) {
+                stack.pop_back();
+                if (!stack.empty()) word.pop_back();
+                continue;
+            }
+
+            int i = countTrailingZeros(top.pending);
+            top.pending &= top.pending - 1;
+
+            uint32_t child = trie.pool.getChild(get(top.node), i);
+            TrieNode* node = get(child);
+
+            word.push_back('a' + i);
+            stack.push_back({ child, node->childMask });
+
+            if (node->isEndOfWord) {
+                returned = true;
+                lastWord = out = word;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Rebuild the stack as if "last" had just been returned
+    void seek(const string& last) {
+        uint32_t node = stack.back().node;
+        stack.clear();
+
+        for (size_t depth = prefixLength; ; depth++) {
+            TrieNode* current = get(node);
+
+            if (depth == last.size()) {
+                stack.push_back({ node, current->childMask });
+                break;
+            }
+
+            // Only the children after the letter of the last word are left
+            int letter = last[depth] - 'a';
+            stack.push_back({ node, current->childMask & ~((2u << letter) - 1) });
+
+            node = trie.pool.getChild(current, letter);
+            if (node == NULL_NODE) break;
+        }
+
+        word = last.substr(0, prefixLength + stack.size() - 1);
+        lastWord = last;
+        returned = true;
+    }
+
+    static bool validToken(const string& token, const string& prefix, string& last) {
+        size_t colon = token.find(':');
+        if (colon == string::npos || colon == 0 || colon > 9) return false;
+
+        for (size_t i = 0; i < colon; i++) {
+            if (token[i] < '0' || token[i] > '9') return false;
+        }
+
+        last = token.substr(colon + 1);
+        for (char c : last) {
+            if (c < 'a' || c > 'z') return false;
+        }
+
+        return stoul(token.substr(0, colon)) == prefix.size() && last.compare(0, prefix.size(), prefix) == 0 && last.size() >= prefix.size();
+    }
+
+public:
+    // Start at the first word of the prefix, or right after the word of a token returned by
+    // an iterator over the same prefix
+    CompletionIterator(Trie& trie, const string& prefix, const string& token = "")
+        : trie(trie), version(0), word(prefix), prefixLength(prefix.size()), pendingWord(false), returned(false) {
+
+        Trie::ReadGuard guard(trie.epochs, trie.concurrentReads);
+
+        start(prefix);
+        if (stack.empty()) return;
+
+        if (!token.empty()) {
+            string last;
+
+            pendingWord = false;
+
+            if (validToken(token, prefix, last)) {
+                seek(last);
+            }
+            else {
+                if (trie.enableLogging) log("[Trie]: Invalid continuation token \"" + token + "\"", RED);
+                stack.clear();
+            }
+        }
+    }
+
+    // Write the next word into "out". Returns false once every word was returned
+    bool next(string& out) {
+        Trie::ReadGuard guard(trie.epochs, trie.concurrentReads);
+
+        if (version != trie.version) resync();
+        return advance(out);
+    }
+
+    // Up to pageSize next words. A page shorter than pageSize is the last one
+    vector<string> nextPage(int pageSize) {
+        Trie::ReadGuard guard(trie.epochs, trie.concurrentReads);
+        vector<string> page;
+        string current;
+
+        if (version != trie.version) resync();
+        while (page.size() < (size_t)pageSize && advance(current)) page.push_back(current);
+
+        return page;
+    }
+
+    // Position after the last word returned, empty if none was returned yet
+    string token() const {
+        if (!returned) return "";
+        return to_string(prefixLength) + ":" + lastWord;
+    }
+};
+
+// Radix (Patricia) trie where chains of single-child nodes are collapsed into edge labels
+struct RadixNode {
+    // Label of the edge coming from the parent
+    string label;
+    bool isEndOfWord;
+
+    // Children sorted by the first letter of their label
+    vector<RadixNode*> children;
+
+    RadixNode(const string& label = "", bool isEndOfWord = false) : label(label), isEndOfWord(isEndOfWord) {}
+};
+
+class RadixTrie {
+private:
+    RadixNode* root;
+    size_t nodeCount;
+	bool enableLogging;
+
+    bool hasWildcard(const string& word) {
+        return word.find_first_of(REGEX_OPERATORS) != string::npos;
+    }
+
+    // Position of the child whose label starts with c, or where it should be inserted
+    size_t findChild(RadixNode* node, char c) {
+        size_t low = 0, high = node->children.size();
+
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+
+            if (node->children[mid]->label[0] < c) low = mid + 1;
+            else high = mid;
+        }
+
+        return low;
+    }
+
+    RadixNode* getChild(RadixNode* node, char c) {
+        size_t i = findChild(node, c);
+        return i < node->children.size() && node->children[i]->label[0] == c ? node->children[i] : nullptr;
+    }
+
+    // Merge a node with its only child if it no longer marks the end of a word
+    void mergeWithChild(RadixNode* node) {
+        if (node == root || node->isEndOfWord || node->children.size() != 1) return;
+
+        RadixNode* child = node->children[0];
+        node->label += child->label;
+        node->isEndOfWord = child->isEndOfWord;
+        node->children = move(child->children);
+
+        delete child;
+        nodeCount--;
+    }
+
+    // Returns true if the node was deleted, so the parent can unlink it
+    bool removeHelper(RadixNode* node, const string& word, size_t idx) {
+        if (idx == word.size()) {
+            if (!node->isEndOfWord) return false;
+            node->isEndOfWord = false;
+        }
+        else {
+            size_t i = findChild(node, word[idx]);
+            if (i == node->children.size()) return false;
+
+            RadixNode* child = node->children[i];
+            if (word.compare(idx, child->label.size(), child->label) != 0) return false;
+
+            if (removeHelper(child, word, idx + child->label.size())) {
+                node->children.erase(node->children.begin() + i);
+            }
+        }
+
+        if (node == root) return false;
+
+        // A leaf that is no longer a word is deleted, a unary node is merged with its child
+        if (node->children.empty() && !node->isEndOfWord) {
+            delete node;
+            nodeCount--;
+            return true;
+        }
+
+        mergeWithChild(node);
+        return false;
+    }
+
+    void suggestHelper(vector<string>& results, RadixNode* node, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (node->isEndOfWord) {
+            results.push_back(currentWord);
+        }
+
+        for (RadixNode* child : node->children) {
+            currentWord += child->label;
+            suggestHelper(results, child, currentWord, wordLimit);
+            currentWord.resize(currentWord.size() - child->label.size());
+        }
+    }
+
+    void searchByRegex(vector<string>& results, RegexAutomaton& regex, int state, RadixNode* node, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (regex.accepting(state) && node->isEndOfWord) results.push_back(currentWord);
+
+        int depth = currentWord.size();
+
+        for (RadixNode* child : node->children) {
+            const string& label = child->label;
+
+            // The automaton has to get through the whole label
+            int next = state;
+            for (size_t k = 0; k < label.size() && next != RegexAutomaton::DEAD; k++) next = regex.step(next, label[k]);
+            if (next == RegexAutomaton::DEAD) continue;
+
+            currentWord += label;
+            searchByRegex(results, regex, next, child, currentWord, wordLimit);
+            currentWord.resize(depth);
+        }
+    }
+
+    // The DP rows of the whole path live in one buffer, the row after the i-th letter of
+    // currentWord starts at rows[i * stride]
+    void fuzzySearchHelper(RadixNode* node, const string& query, int maxDistance,
+        vector<int>& rows, string& currentWord, vector<pair<string, int>>& results) {
+
+        size_t stride = query.size() + 1;
+        size_t length = currentWord.size();
+        size_t depth = length + node->label.size();
+        if (rows.size() < (depth + 1) * stride) rows.resize((depth + 1) * stride);
+
+        // Advance the DP over the whole edge label before looking at the node
+        for (size_t k = 0; k < node->label.size(); k++) {
+            int rowMin = computeEditRow(query, &rows[(length + k) * stride], node->label[k], &rows[(length + k + 1) * stride]);
+
+            // Prune in the middle of the edge, no word ends there
+            if (rowMin > maxDistance) return;
+        }
+
+        int distance = rows[depth * stride + stride - 1];
+        currentWord += node->label;
+
+        if (distance <= maxDistance && node->isEndOfWord) {
+            results.push_back({ currentWord, distance });
+        }
+
+        for (RadixNode* child : node->children) {
+            fuzzySearchHelper(child, query, maxDistance, rows, currentWord, results);
+        }
+
+        currentWord.resize(length);
+    }
+
+    void clearTrie(RadixNode* node) {
+        for (RadixNode* child : node->children) {
+            clearTrie(child);
+        }
+
+        delete node;
+    }
+
+public:
+    RadixTrie() : nodeCount(1), enableLogging(true) {
+        root = new RadixNode();
+    }
+
+    void setLogging(bool enable) {
+        enableLogging = enable;
+    }
+
+    size_t getNodeCount() {
+        return nodeCount;
+    }
+
+    void loadDictionary(const string& filename) {
+        ifstream ifile(filename);
+        string word;
+
+        if (!ifile.is_open()) {
+            if (enableLogging) log("[Radix Trie]: Error opening file", RED);
+            return;
+        }
+
+        if (enableLogging) log("Loading dictionary...", YELLOW);
+        while (getline(ifile, word)) {
+            // Assume that the word has no leading and trailing spaces
+            if (word.empty()) continue;
+
+            insert(word);
+        }
+
+        if (enableLogging) log("[Radix Trie]: Dictionary loaded successfully", GREEN);
+
+        ifile.close();
+    }
+
+    void insert(const string& word) {
+        RadixNode* node = root;
+        size_t idx = 0;
+
+        while (idx < word.size()) {
+            size_t i = findChild(node, word[idx]);
+
+            // No edge starts with the next letter, hang the rest of the word below the node
+            if (i == node->children.size() || node->children[i]->label[0] != word[idx]) {
+                node->children.insert(node->children.begin() + i, new RadixNode(word.substr(idx), true));
+                nodeCount++;
+                return;
+            }
+
+            RadixNode* child = node->children[i];
+            const string& label = child->label;
+
+            size_t common = 0;
+            while (common < label.size() && idx + common < word.size() && label[common] == word[idx + common]) common++;
+
+            // Split the edge where the word leaves the label
+            if (common < label.size()) {
+                RadixNode* middle = new RadixNode(label.substr(0, common));
+                nodeCount++;
+
+                child->label = label.substr(common);
+                middle->children.push_back(child);
+                node->children[i] = middle;
+
+                if (idx + common == word.size()) {
+                    middle->isEndOfWord = true;
+                }
+                else {
+                    RadixNode* leaf = new RadixNode(word.substr(idx + common), true);
+                    nodeCount++;
+
+                    if (leaf->label[0] < child->label[0]) middle->children.insert(middle->children.begin(), leaf);
+                    else middle->children.push_back(leaf);
+                }
+
+                return;
+            }
+
+            node = child;
+            idx += common;
+        }
+
+        node->isEndOfWord = true;
+    }
+
+    void remove(const string& word) {
+        removeHelper(root, word, 0);
+    }
+
+    bool contains(const string& word) {
+        RadixNode* node = root;
+        size_t idx = 0;
+
+        while (idx < word.size()) {
+            node = getChild(node, word[idx]);
+            if (!node || word.compare(idx, node->label.size(), node->label) != 0) return false;
+
+            idx += node->label.size();
+        }
+
+        return node->isEndOfWord;
+    }
+
+    // Find the node whose edge contains the end of the prefix. The word spelled by the
+    // path down to that node, which may be longer than the prefix, is written to pathWord.
+    RadixNode* searchPrefix(const string& prefix, string& pathWord) {
+        RadixNode* node = root;
+        size_t idx = 0;
+
+        while (idx < prefix.size()) {
+            node = getChild(node, prefix[idx]);
+            if (!node) return nullptr;
+
+            // The prefix may stop in the middle of the label
+            size_t length = min(node->label.size(), prefix.size() - idx);
+            if (prefix.compare(idx, length, node->label, 0, length) != 0) return nullptr;
+
+            idx += node->label.size();
+        }
+
+        pathWord = prefix.substr(0, min(idx, prefix.size()));
+        if (idx > prefix.size()) pathWord += node->label.substr(node->label.size() - (idx - prefix.size()));
+
+        return node;
+    }
+
+    vector<string> suggest(const string& prefix, int wordLimit = 10) {
+        vector<string> results;
+
+        if (!hasWildcard(prefix)) {
+            string currentWord;
+            RadixNode* node = searchPrefix(prefix, currentWord);
+
+            if (node) suggestHelper(results, node, currentWord, wordLimit);
+        }
+        else {
+            RegexAutomaton regex;
+            string currentWord;
+
+            if (!regex.compile(prefix)) {
+                if (enableLogging) log("[Radix Trie]: Invalid regex: " + prefix, RED);
+            }
+            else if (regex.start() != RegexAutomaton::DEAD) {
+                searchByRegex(results, regex, regex.start(), root, currentWord, wordLimit);
+            }
+        }
+
+        return results;
+    }
+
+    vector<string> fuzzySearch(const string& query, int maxDistance = 1, int wordLimit = 10) {
+        vector<pair<string, int>> results;
+        vector<int> rows(query.size() + 1);
+
+        for (size_t i = 0; i <= query.size(); ++i) {
+            rows[i] = i;
+        }
+
+        string currentWord = "";
+        for (RadixNode* child : root->children) {
+            fuzzySearchHelper(child, query, maxDistance, rows, currentWord, results);
+        }
+
+        // Sort the results by Levenshtein distance. Words at the same distance stay in alphabetical order
+        stable_sort(results.begin(), results.end(), [](const pair<string, int>& a, const pair<string, int>& b) {
+            return a.second < b.second;
+            });
+
+        vector<string> finalResults;
+        for (int i = 0; i < (int)results.size() && i < wordLimit; i++) {
+            finalResults.push_back(results[i].first);
+        }
+
+        return finalResults;
+    }
+
+    void releaseTrie() {
+        clearTrie(root);
+        root = new RadixNode();
+        nodeCount = 1;
+    }
+
+    ~RadixTrie() {
+        clearTrie(root);
+    }
+};
+
+// Double-array trie. A transition from state s on letter code c goes to t = base[s] + c
+// and is valid only if check[t] == s, so each step reads two integers from contiguous
+// arrays instead of following a pointer. State 0 is the root.
+class DoubleArrayTrie {
+private:
+    // Free cells have a negative check and form a doubly linked list stored in the cells
+    // themselves: check[t] = -(next + 2) and base[t] = -(previous + 2), where -1 means none
+    vector<int32_t> base;
+    vector<int32_t> check;
+
+    // Letters of the existing children of each state, used to enumerate and relocate them
+    vector<uint32_t> childMask;
+    vector<char> terminal;
+
+    int32_t freeHead;
+    int32_t freeTail;
+
+    // One past the highest cell ever used, every cell from here on is free
+    int32_t usedEnd;
+    size_t nodeCount;
+	bool enableLogging;
+
+    // Number of free cells tried before a new base is taken from the end of the arrays
+    static const int MAX_BASE_TRIES = 256;
+
+    bool hasWildcard(const string& word) {
+        return word.find_first_of(REGEX_OPERATORS) != string::npos;
+    }
+
+    static int code(char c) {
+        return c - 'a' + 1;
+    }
+
+    int32_t nextFree(int32_t t) {
+        return -check[t] - 2;
+    }
+
+    int32_t previousFree(int32_t t) {
+        return -base[t] - 2;
+    }
+
+    // Append a cell to the end of the free list
+    void linkFree(int32_t t) {
+        base[t] = -(freeTail + 2);
+        check[t] = -1;
+        childMask[t] = 0;
+        terminal[t] = false;
+
+        if (freeTail == -1) freeHead = t;
+        else check[freeTail] = -(t + 2);
+
+        freeTail = t;
+    }
+
+    // Take a cell out of the free list before it is used by a state
+    void claimCell(int32_t t, int32_t parent) {
+        ensureSize(t + 1);
+
+        int32_t next = nextFree(t), previous = previousFree(t);
+
+        if (previous == -1) freeHead = next;
+        else check[previous] = -(next + 2);
+
+        if (next == -1) freeTail = previous;
+        else base[next] = -(previous + 2);
+
+        base[t] = 0;
+        check[t] = parent;
+        childMask[t] = 0;
+        terminal[t] = false;
+
+        usedEnd = max(usedEnd, t + 1);
+    }
+
+    void ensureSize(size_t size) {
+        if (size <= check.size()) return;
+
+        size_t oldSize = check.size();
+        size_t newSize = max(size, oldSize * 2);
+
+        base.resize(newSize);
+        check.resize(newSize);
+        childMask.resize(newSize);
+        terminal.resize(newSize);
+
+        for (size_t t = oldSize; t < newSize; t++) linkFree((int32_t)t);
+    }
+
+    bool isFree(int32_t t) {
+        return (size_t)t >= check.size() || check[t] < 0;
+    }
+
+    // Find a base such that the cells of every letter in the mask are free
+    int32_t findBase(uint32_t mask) {
+        int lowest = countTrailingZeros(mask) + 1;
+        int tried = 0;
+
+        // Only free cells are visited, each one is tried as the cell of the lowest letter
+        int32_t f = freeHead, last = -1;
+        for (; f != -1 && tried < MAX_BASE_TRIES; last = f, f = nextFree(f), tried++) {
+            int32_t candidate = f - lowest;
+            if (candidate < 0) continue;
+
+            bool fits = true;
+            for (uint32_t bits = mask & (mask - 1); bits && fits; bits &= bits - 1) {
+                fits = isFree(candidate + countTrailingZeros(bits) + 1);
+            }
+
+            if (fits) return candidate;
+        }
+
+        // Move the cells that were tried to the back of the list so the next search
+        // starts with other cells instead of failing on the same crowded ones again
+        if (f != -1 && freeTail != last) {
+            check[last] = -1;
+            check[freeTail] = -(freeHead + 2);
+            base[freeHead] = -(freeTail + 2);
+            base[f] = -1;
+
+            freeTail = last;
+            freeHead = f;
+        }
+
+        // Fall back to the cells after the highest one in use, which are all free
+        return usedEnd;
+    }
+
+    // Move all children of a state to a new base that also has room for newCode
+    void relocate(int32_t s, int newCode) {
+        int32_t oldBase = base[s];
+        int32_t newBase = findBase(childMask[s] | (1u << (newCode - 1)));
+
+        for (uint32_t bits = childMask[s]; bits; bits &= bits - 1) {
+            int c = countTrailingZeros(bits) + 1;
+            int32_t from = oldBase + c, to = newBase + c;
+
+            claimCell(to, s);
+            base[to] = base[from];
+            childMask[to] = childMask[from];
+            terminal[to] = terminal[from];
+
+            // The grandchildren now have to point back to the new cell
+            for (uint32_t grand = childMask[from]; grand; grand &= grand - 1) {
+                check[base[from] + countTrailingZeros(grand) + 1] = to;
+            }
+
+            linkFree(from);
+        }
+
+        base[s] = newBase;
+    }
+
+    int32_t transition(int32_t s, char c) {
+        comparisons++;
+        int32_t t = base[s] + code(c);
+
+        comparisons++;
+        return (size_t)t < check.size() && check[t] == s ? t : -1;
+    }
+
+    void suggestHelper(vector<string>& results, int32_t s, string& currentWord, int wordLimit) {
+        comparisons++;
+        if (results.size() >= (size_t)wordLimit) return;
+
+        comparisons++;
+        if (terminal[s]) {
+            results.push_back(currentWord);
+        }
+
+        for (uint32_t bits = childMask[s]; bits; bits &= bits - 1) {
+            comparisons++;
+            int c = countTrailingZeros(bits) + 1;
+
+            currentWord.push_back('a' + c - 1);
+            suggestHelper(results, base[s] + c, currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void searchByRegex(vector<string>& results, RegexAutomaton& regex, int state, int32_t s, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (regex.accepting(state) && terminal[s]) results.push_back(currentWord);
+
+        for (uint32_t bits = childMask[s] & regex.letters(state); bits; bits &= bits - 1) {
+            int c = countTrailingZeros(bits) + 1;
+            int next = regex.step(state, 'a' + c - 1);
+
+            if (next == RegexAutomaton::DEAD) continue;
+
+            currentWord.push_back('a' + c - 1);
+            searchByRegex(results, regex, next, base[s] + c, currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void fuzzySearchHelper(int32_t s, const string& query, int maxDistance,
+        const vector<int>& previousRow, string& currentWord, vector<pair<string, int>>& results) {
+
+        vector<int> currentRow;
+        int rowMin = computeEditRow(query, previousRow, currentWord.back(), currentRow);
+
+        if (currentRow.back() <= maxDistance && terminal[s]) {
+            results.push_back({ currentWord, currentRow.back() });
+        }
+
+        if (rowMin > maxDistance) return;
+
+        for (uint32_t bits = childMask[s]; bits; bits &= bits - 1) {
+            int c = countTrailingZeros(bits) + 1;
+
+            currentWord.push_back('a' + c - 1);
+            fuzzySearchHelper(base[s] + c, query, maxDistance, currentRow, currentWord, results);
+            currentWord.pop_back();
+        }
+    }
+
+public:
+    int comparisons;
+
+    DoubleArrayTrie() : freeHead(-1), freeTail(-1), usedEnd(0), nodeCount(1), enableLogging(true), comparisons(0) {
+        releaseDoubleArray();
+    }
+
+    void setLogging(bool enable) {
+        enableLogging = enable;
+    }
+
+    size_t getNodeCount() {
+        return nodeCount;
+    }
+
+    // Bytes used by the four parallel arrays
+    size_t getMemoryUsage() {
+        return check.size() * (sizeof(int32_t) * 2 + sizeof(uint32_t) + sizeof(char));
+    }
+
+    void loadDictionary(const string& filename) {
+        ifstream ifile(filename);
+        string word;
+
+        if (!ifile.is_open()) {
+            if (enableLogging) log("[Double Array]: Error opening file", RED);
+            return;
+        }
+
+        if (enableLogging) log("Loading dictionary...", YELLOW);
+        while (getline(ifile, word)) {
+            // Assume that the word has no leading and trailing spaces
+            if (word.empty()) continue;
+
+            insert(word);
+        }
+
+        if (enableLogging) log("[Double Array]: Dictionary loaded successfully", GREEN);
+
+        ifile.close();
+    }
+
+    void insert(const string& word) {
+        int32_t s = 0;
+
+        for (char c : word) {
+            int32_t next = transition(s, c);
+
+            if (next == -1) {
+                int cc = code(c);
+
+                // A state without children gets a fresh base. Otherwise move its children
+                // if the cell for the new letter is taken by another state
+                if (childMask[s] == 0) base[s] = findBase(1u << (cc - 1));
+                else if (!isFree(base[s] + cc)) relocate(s, cc);
+
+                next = base[s] + cc;
+                claimCell(next, s);
+                childMask[s] |= 1u << (cc - 1);
+                nodeCount++;
+            }
+
+            s = next;
+        }
+
+        terminal[s] = true;
+    }
+
+    void remove(const string& word) {
+        int32_t s = searchPrefix(word);
+        if (s == -1 || !terminal[s]) return;
+
+        terminal[s] = false;
+
+        // Free the states that no longer lead to a word, the parent is stored in check
+        while (s != 0 && childMask[s] == 0 && !terminal[s]) {
+            int32_t parent = check[s];
+
+            childMask[parent] &= ~(1u << (s - base[parent] - 1));
+            linkFree(s);
+            nodeCount--;
+
+            s = parent;
+        }
+    }
+
+    // Returns the state where the prefix ends, or -1
+    int32_t searchPrefix(const string& prefix) {
+        int32_t s = 0;
+
+        for (char c : prefix) {
+            s = transition(s, c);
+            if (s == -1) return -1;
+        }
+
+        return s;
+    }
+
+    bool isEndOfWord(int32_t s) {
+        return terminal[s];
+    }
+
+    vector<string> suggest(const string& prefix, int wordLimit = 10) {
+        vector<string> results;
+
+        if (!hasWildcard(prefix)) {
+            int32_t s = searchPrefix(prefix);
+            string currentWord = prefix;
+
+            comparisons++;
+            if (s != -1) suggestHelper(results, s, currentWord, wordLimit);
+        }
+        else {
+            RegexAutomaton regex;
+            string currentWord;
+
+            if (!regex.compile(prefix)) {
+                if (enableLogging) log("[Double Array]: Invalid regex: " + prefix, RED);
+            }
+            else if (regex.start() != RegexAutomaton::DEAD) {
+                searchByRegex(results, regex, regex.start(), 0, currentWord, wordLimit);
+            }
+        }
+
+        return results;
+    }
+
+    vector<string> fuzzySearch(const string& query, int maxDistance = 1, int wordLimit = 10) {
+        vector<pair<string, int>> results;
+        vector<int> firstRow(query.size() + 1);
+
+        for (size_t i = 0; i <= query.size(); ++i) {
+            firstRow[i] = i;
+        }
+
+        string currentWord = "";
+        for (uint32_t bits = childMask[0]; bits; bits &= bits - 1) {
+            int c = countTrailingZeros(bits) + 1;
+
+            currentWord.push_back('a' + c - 1);
+            fuzzySearchHelper(base[0] + c, query, maxDistance, firstRow, currentWord, results);
+            currentWord.pop_back();
+        }
+
+        // Sort the results by Levenshtein distance. Words at the same distance stay in alphabetical order
+        stable_sort(results.begin(), results.end(), [](const pair<string, int>& a, const pair<string, int>& b) {
+            return a.second < b.second;
+            });
+
+        vector<string> finalResults;
+        for (int i = 0; i < (int)results.size() && i < wordLimit; i++) {
+            finalResults.push_back(results[i].first);
+        }
+
+        return finalResults;
+    }
+
+    void releaseDoubleArray() {
+        base.clear();
+        check.clear();
+        childMask.clear();
+        terminal.clear();
+        freeHead = freeTail = -1;
+        usedEnd = 0;
+
+        ensureSize(1024);
+        claimCell(0, 0);
+        nodeCount = 1;
+    }
+};
+
+// Minimal acyclic word automaton (DAFSA). Unlike the trie it also shares suffixes: two states
+// are merged whenever they accept the same set of endings. Built with the incremental
+// algorithm of Daciuk et al. over sorted input, then stored as flat edge arrays.
+class Dafsa {
+private:
+    // Edges of state s are edgeLabels / edgeTargets[firstEdge[s] .. firstEdge[s + 1]), sorted by letter
+    vector<uint32_t> firstEdge;
+    vector<char> edgeLabels;
+    vector<uint32_t> edgeTargets;
+    vector<char> finals;
+	bool enableLogging;
+
+    // States while building, before they are moved to the flat arrays
+    struct BuildState {
+        bool isFinal;
+        vector<pair<char, uint32_t>> edges;
+    };
+
+    bool hasWildcard(const string& word) {
+        return word.find_first_of(REGEX_OPERATORS) != string::npos;
+    }
+
+    // Key that is equal for two states exactly when they accept the same endings,
+    // given that their children are already minimized
+    static string signature(const BuildState& state) {
+        string key(1, state.isFinal ? '1' : '0');
+
+        for (auto& edge : state.edges) {
+            key.push_back(edge.first);
+            key.append((const char*)&edge.second, sizeof(uint32_t));
+        }
+
+        return key;
+    }
+
+    // Replace the states on the last added path below the given depth by equivalent
+    // registered states, or register them if there is none yet
+    static void minimize(vector<BuildState>& states, vector<uint32_t>& path, unordered_map<string, uint32_t>& registry,
+        vector<uint32_t>& freeStates, size_t depth) {
+
+        while (path.size() > depth + 1) {
+            uint32_t child = path.back();
+            path.pop_back();
+
+            string key = signature(states[child]);
+            auto found = registry.find(key);
+
+            if (found != registry.end()) {
+                states[path.back()].edges.back().second = found->second;
+                states[child].edges.clear();
+                freeStates.push_back(child);
+            }
+            else {
+                registry.emplace(move(key), child);
+            }
+        }
+    }
+
+    void suggestHelper(vector<string>& results, uint32_t state, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (finals[state]) {
+            results.push_back(currentWord);
+        }
+
+        for (uint32_t e = firstEdge[state]; e < firstEdge[state + 1]; e++) {
+            currentWord.push_back(edgeLabels[e]);
+            suggestHelper(results, edgeTargets[e], currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void searchByRegex(vector<string>& results, RegexAutomaton& regex, int regexState, uint32_t state, string& currentWord, int wordLimit) {
+        if (results.size() >= (size_t)wordLimit) return;
+
+        if (regex.accepting(regexState) && finals[state]) results.push_back(currentWord);
+
+        for (uint32_t e = firstEdge[state]; e < firstEdge[state + 1]; e++) {
+            if (!(regex.letters(regexState) & (1u << (edgeLabels[e] - 'a')))) continue;
+
+            int next = regex.step(regexState, edgeLabels[e]);
+            if (next == RegexAutomaton::DEAD) continue;
+
+            currentWord.push_back(edgeLabels[e]);
+            searchByRegex(results, regex, next, edgeTargets[e], currentWord, wordLimit);
+            currentWord.pop_back();
+        }
+    }
+
+    void fuzzySearchHelper(uint32_t state, const string& query, int maxDistance,
+        const vector<int>& previousRow, string& currentWord, vector<pair<string, int>>& results) {
+
+        vector<int> currentRow;
+        int rowMin = computeEditRow(query, previousRow, currentWord.back(), currentRow);
+
+        if (currentRow.back() <= maxDistance && finals[state]) {
+            results.push_back({ currentWord, currentRow.back() });
+        }
+
+        if (rowMin > maxDistance) return;
+
+        for (uint32_t e = firstEdge[state]; e < firstEdge[state + 1]; e++) {
+            currentWord.push_back(edgeLabels[e]);
+            fuzzySearchHelper(edgeTargets[e], query, maxDistance, currentRow, currentWord, results);
+            currentWord.pop_back();
+        }
+    }
+
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    Dafsa() : enableLogging(true) {
+        build({});
+    }
+
+    void setLogging(bool enable) {
+        enableLogging = enable;
+    }
+
+    size_t getNodeCount() {
+        return finals.size();
+    }
+
+    size_t getEdgeCount() {
+        return edgeLabels.size();
+    }
+
+    // Bytes used by the flat state and edge arrays
+    size_t getMemoryUsage() {
+        return firstEdge.size() * sizeof(uint32_t) + edgeLabels.size() * (sizeof(char) + sizeof(uint32_t)) + finals.size();
+    }
+
+    void loadDictionary(const string& filename) {
+        ifstream ifile(filename);
+        string word;
+        vector<string> words;
+
+        if (!ifile.is_open()) {
+            if (enableLogging) log("[DAFSA]: Error opening file", RED);
+            return;
+        }
+
+        if (enableLogging) log("Loading dictionary...", YELLOW);
+        while (getline(ifile, word)) {
+            // Assume that the word has no leading and trailing spaces
+            if (word.empty()) continue;
+
+            words.push_back(word);
+        }
+
+        ifile.close();
+
+        // The incremental construction needs the words in sorted order
+        sort(words.begin(), words.end());
+        build(words);
+
+        if (enableLogging) log("[DAFSA]: Dictionary loaded successfully with " + to_string(getNodeCount()) + " states", GREEN);
+    }
+
+    // Build the automaton from words sorted in ascending order. Duplicates are ignored.
+    // Returns false and keeps the previous automaton if the words are not sorted
+    bool build(const vector<string>& words) {
+        vector<BuildState> states(1, BuildState{ false, {} });
+        vector<uint32_t> freeStates;
+        unordered_map<string, uint32_t> registry;
+
+        // States along the path of the previous word, starting with the root
+        vector<uint32_t> path = { 0 };
+        const string* previous = nullptr;
+
+        for (const string& word : words) {
+            if (previous && word < *previous) {
+                if (enableLogging) log("[DAFSA]: Words are not sorted at \"" + word + "\"", RED);
+                return false;
+            }
+
+            size_t common = 0;
+            if (previous) {
+                while (common < word.size() && common < previous->size() && word[common] == (*previous)[common]) common++;
+            }
+
+            // The part of the previous word after the common prefix can no longer change
+            minimize(states, path, registry, freeStates, common);
+
+            for (size_t i = common; i < word.size(); i++) {
+                uint32_t state;
+
+                if (!freeStates.empty()) {
+                    state = freeStates.back();
+                    freeStates.pop_back();
+                    states[state].isFinal = false;
+                }
+                else {
+                    state = states.size();
+                    states.push_back(BuildState{ false, {} });
+                }
+
+                states[path.back()].edges.push_back({ word[i], state });
+                path.push_back(state);
+            }
+
+            states[path.back()].isFinal = true;
+            previous = &word;
+        }
+
+        minimize(states, path, registry, freeStates, 0);
+
+        // Number the reachable states breadth-first and lay the edges out flat
+        vector<uint32_t> newId(states.size(), NOT_FOUND);
+        vector<uint32_t> order = { 0 };
+        newId[0] = 0;
+
+        for (size_t head = 0; head < order.size(); head++) {
+            for (auto& edge : states[order[head]].edges) {
+                if (newId[edge.second] == NOT_FOUND) {
+                    newId[edge.second] = order.size();
+                    order.push_back(edge.second);
+                }
+            }
+        }
+
+        firstEdge.assign(1, 0);
+        edgeLabels.clear();
+        edgeTargets.clear();
+        finals.clear();
+
+        for (uint32_t state : order) {
+            for (auto& edge : states[state].edges) {
+                edgeLabels.push_back(edge.first);
+                edgeTargets.push_back(newId[edge.second]);
+            }
+
+            firstEdge.push_back(edgeLabels.size());
+            finals.push_back(states[state].isFinal);
+        }
+
+        return true;
+    }
+
+    // Returns the state where the prefix ends, or NOT_FOUND
+    uint32_t searchPrefix(const string& prefix) {
+        uint32_t state = 0;
+
+        for (char c : prefix) {
+            uint32_t next = NOT_FOUND;
+
+            for (uint32_t e = firstEdge[state]; e < firstEdge[state + 1] && edgeLabels[e] <= c; e++) {
+                if (edgeLabels[e] == c) next = edgeTargets[e];
+            }
+
+            if (next == NOT_FOUND) return NOT_FOUND;
+            state = next;
+        }
+
+        return state;
+    }
+
+    bool isEndOfWord(uint32_t state) {
+        return finals[state];
+    }
+
+    vector<string> suggest(const string& prefix, int wordLimit = 10) {
+        vector<string> results;
+
+        if (!hasWildcard(prefix)) {
+            uint32_t state = searchPrefix(prefix);
+            string currentWord = prefix;
+
+            if (state != NOT_FOUND) suggestHelper(results, state, currentWord, wordLimit);
+        }
+        else {
+            RegexAutomaton regex;
+            string currentWord;
+
+            if (!regex.compile(prefix)) {
+                if (enableLogging) log("[DAFSA]: Invalid regex: " + prefix, RED);
+            }
+            else if (regex.start() != RegexAutomaton::DEAD) {
+                searchByRegex(results, regex, regex.start(), 0, currentWord, wordLimit);
+            }
+        }
+
+        return results;
+    }
+
+    vector<string> fuzzySearch(const string& query, int maxDistance = 1, int wordLimit = 10) {
+        vector<pair<string, int>> results;
+        vector<int> firstRow(query.size() + 1);
+
+        for (size_t i = 0; i <= query.size(); ++i) {
+            firstRow[i] = i;
+        }
+
+        string currentWord = "";
+        for (uint32_t e = firstEdge[0]; e < firstEdge[1]; e++) {
+            currentWord.push_back(edgeLabels[e]);
+            fuzzySearchHelper(edgeTargets[e], query, maxDistance, firstRow, currentWord, results);
+            currentWord.pop_back();
+        }
+
+        // Sort the results by Levenshtein distance. Words at the same distance stay in alphabetical order
+        stable_sort(results.begin(), results.end(), [](const pair<string, int>& a, const pair<string, int>& b) {
+            return a.second < b.second;
+            });
+
+        vector<string> finalResults;
+        for (int i = 0; i < (int)results.size() && i < wordLimit; i++) {
+            finalResults.push_back(results[i].first);
+        }
+
+        return finalResults;
+    }
+};
+
+const uint32_t Dafsa::NOT_FOUND;
+
+#ifdef __linux__
+// Query server over a Unix domain socket. A request is one line, or "*<length>\n" followed by
+// that many bytes, and is answered the same way with "ok" and the words, or "error" and the
+// reason. Requests:
+//   suggest <prefix> [limit]              completions, or regex matches if the prefix has operators
+//   regex <pattern> [limit]               whole words matching the pattern
+//   fuzzy <query> [distance] [limit]      words within the edit distance
+//   insert <word>, remove <word>
+//   stats                                 requests served, throughput and latency percentiles
+// One thread waits on epoll and hands readable connections to a fixed pool of workers. A
+// connection is armed with EPOLLONESHOT, so only one worker has it at a time: every request
+// already received is answered in order, which lets clients pipeline them. The trie is
+// switched to concurrent mode while the server runs, so writes do not stop the readers
+class QueryServer {
+private:
+    struct Connection {
+        int fd;
+        string input;
+        string output;
+
+        // Never contended, one-shot events hand a connection to one worker at a time. Taking
+        // it makes the hand-off through epoll visible to thread checkers
+        mutex lock;
+
+        Connection(int fd) : fd(fd) {}
+    };
+
+    // Requests over this size without their end close the connection
+    static const size_t MAX_REQUEST = 1 << 20;
+
+    // Once this much output waits for a client that does not read it, the connection stops
+    // reading and answering until the client took some of it
+    static const size_t MAX_OUTPUT = 1 << 20;
+    static const size_t MAX_PATTERN = 4096;
+    static const int LATENCY_BUCKETS = 256;
+
+    Trie& trie;
+    string path;
+    unsigned workerCount;
+    bool enableLogging;
+
+    int listenFd;
+    int epollFd;
+
+    // Written by stop() to wake the epoll thread, safe to call from a signal handler
+    int wakeFd;
+
+    vector<thread> workers;
+    queue<Connection*> ready;
+    mutex readyLock;
+    condition_variable readyChanged;
+    bool stopping;
+
+    // Every open connection, closed by whoever holds it or at the end of run()
+    unordered_set<Connection*> connections;
+    mutex connectionsLock;
+
+    // Latencies in nanoseconds, four buckets per power of two
+    atomic<uint64_t> served;
+    atomic<uint64_t> latencies[LATENCY_BUCKETS];
+    steady_clock::time_point started;
+
+    static int latencyBucket(uint64_t ns) {
+        if (ns < 4) return (int)ns;
+
+        int power = 63 - __builtin_clzll(ns);
+        return 4 * power + (int)((ns >> (power - 2)) & 3);
+    }
+
+    // Smallest latency of a bucket
+    static uint64_t bucketLatency(int bucket) {
+        if (bucket < 4) return bucket;
+        return (uint64_t)(4 + bucket % 4) << (bucket / 4 - 2);
+    }
+
+    static bool isWord(const string& text) {
+        return text.find_first_not_of("abcdefghijklmnopqrstuvwxyz") == string::npos;
+    }
+
+    // Patterns longer than MAX_PATTERN or nested deeper than the regex parser accepts are
+    // refused before they reach the trie. The regex command adds one pair of parentheses
+    static bool patternTooLong(const string& pattern) {
+        if (pattern.size() > MAX_PATTERN) return true;
+
+        int nesting = 0, deepest = 0;
+        for (char c : pattern) {
+            if (c == '(') deepest = max(deepest, ++nesting);
+            else if (c == ')') nesting--;
+        }
+
+        return deepest >= RegexAutomaton::MAX_NESTING;
+    }
+
+    static bool parseNumber(const string& text, int& value) {
+        if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != string::npos) return false;
+
+        value = atoi(text.c_str());
+        return true;
+    }
+
+    void arm(Connection* connection) {
+        epoll_event event = {};
+        event.events = EPOLLONESHOT;
+        event.data.ptr = connection;
+
+        if (connection->output.size() >= MAX_OUTPUT) event.events |= EPOLLOUT;
+        else event.events |= EPOLLIN | EPOLLRDHUP | (connection->output.empty() ? 0u : (uint32_t)EPOLLOUT);
+
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+    }
+
+    void closeConnection(Connection* connection) {
+        {
+            lock_guard<mutex> lock(connectionsLock);
+            connections.erase(connection);
+        }
+
+        ::close(connection->fd);
+        delete connection;
+    }
+
+    static string join(const vector<string>& words) {
+        string text = "ok";
+        for (const string& word : words) text += " " + word;
+
+        return text;
+    }
+
+    string answer(const string& request) {
+        vector<string> args;
+        size_t start = 0;
+
+        while (start < request.size()) {
+            size_t end = request.find(' ', start);
+            if (end == string::npos) end = request.size();
+            if (end > start) args.push_back(request.substr(start, end - start));
+            start = end + 1;
+        }
+
+        if (args.empty()) return "error empty request";
+
+        const string& command = args[0];
+        int limit = 10, distance = 1;
+
+        if (command == "stats") return "ok " + statistics();
+
+        if (command != "suggest" && command != "regex" && command != "fuzzy" && command != "insert" && command != "remove") {
+            return "error unknown command " + command;
+        }
+        if (args.size() < 2) return "error missing argument";
+
+        if (command == "suggest" || command == "regex") {
+            if (args.size() > 3 || (args.size() == 3 && !parseNumber(args[2], limit))) return "error bad limit";
+            if (patternTooLong(args[1])) return "error pattern too long";
+
+            // A pattern without operators would be completed as a prefix, the parentheses
+            // keep it a whole-word regex
+            if (command == "regex") return join(trie.suggest("(" + args[1] + ")", limit));
+
+            // No word starts with anything but letters
+            if (args[1].find_first_of(REGEX_OPERATORS) == string::npos && !isWord(args[1])) return "ok";
+            return join(trie.suggest(args[1], limit));
+        }
+
+        if (command == "insert" || command == "remove") {
+            const string& word = args[1];
+            if (args.size() > 2 || !isWord(word)) return "error words are lowercase letters only";
+
+            if (command == "insert") trie.insert(word);
+            else trie.remove(word);
+
+            return "ok";
+        }
+
+        if (args.size() > 4 || (args.size() >= 3 && !parseNumber(args[2], distance)) || (args.size() == 4 && !parseNumber(args[3], limit))) {
+            return "error bad distance or limit";
+        }
+
+        // Larger distances cost more without reaching the words of the dictionaries
+        return join(trie.fuzzySearch(args[1], min(distance, Trie::MAX_FUZZY_DISTANCE), limit));
+    }
+
+    // Answer the complete requests in the input, until the output is full. Returns false if
+    // the input is malformed
+    bool process(Connection* connection) {
+        string& input = connection->input;
+        size_t position = 0;
+
+        while (position < input.size() && connection->output.size() < MAX_OUTPUT) {
+            size_t newline = input.find('\n', position);
+            string request;
+            bool framed = input[position] == '*';
+
+            if (newline == string::npos) break;
+
+            if (framed) {
+                int length;
+                if (!parseNumber(input.substr(position + 1, newline - position - 1), length)) return false;
+                if (input.size() - newline - 1 < (size_t)length) break;
+
+                request = input.substr(newline + 1, length);
+                position = newline + 1 + length;
+            }
+            else {
+                request = input.substr(position, newline - position);
+                if (!request.empty() && request.back() == '\r') request.pop_back();
+                position = newline + 1;
+            }
+
+            auto begin = steady_clock::now();
+            string response = answer(request);
+            uint64_t elapsed = (uint64_t)duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+
+            latencies[latencyBucket(elapsed)]++;
+            served++;
+
+            if (framed) connection->output += "*" + to_string(response.size()) + "\n" + response;
+            else connection->output += response + "\n";
+        }
+
+        input.erase(0, position);
+        return connection->output.size() >= MAX_OUTPUT || input.size() <= MAX_REQUEST;
+    }
+
+    // Read what arrived, answer it and write back as much as the socket takes. The rest of
+    // the output waits for the socket to be writable again
+    void serve(Connection* connection) {
+        unique_lock<mutex> lock(connection->lock);
+        char buffer[4096];
+        bool keep = true;
+
+        // Reading stops at a request too long to be valid and while the output is full, the
+        // rest stays in the socket until the next call
+        while (connection->input.size() <= MAX_REQUEST && connection->output.size() < MAX_OUTPUT) {
+            ssize_t count = read(connection->fd, buffer, sizeof(buffer));
+
+            if (count > 0) connection->input.append(buffer, count);
+            else if (count < 0 && errno == EINTR) continue;
+            else {
+                // The peer closed its side or the socket failed, answer what is left anyway
+                if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) keep = false;
+                break;
+            }
+        }
+
+        bool writable = true;
+        while (true) {
+            size_t pending = connection->input.size();
+
+            if (!process(connection)) {
+                connection->output += "error malformed request\n";
+                keep = false;
+            }
+
+            size_t sent = 0;
+            while (sent < connection->output.size()) {
+                ssize_t count = send(connection->fd, connection->output.data() + sent, connection->output.size() - sent, MSG_NOSIGNAL);
+
+                if (count > 0) sent += count;
+                else if (count < 0 && errno == EINTR) continue;
+                else {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) keep = false;
+                    writable = false;
+                    break;
+                }
+            }
+            connection->output.erase(0, sent);
+
+            // Requests held back by a full output are answered once the socket took it all
+            if (!keep || !writable || connection->input.size() == pending) break;
+        }
+
+        if (keep) {
+            arm(connection);
+        }
+        else {
+            lock.unlock();
+            closeConnection(connection);
+        }
+    }
+
+    void work() {
+        while (true) {
+            Connection* connection;
+            {
+                unique_lock<mutex> lock(readyLock);
+                readyChanged.wait(lock, [this]() { return stopping || !ready.empty(); });
 
-        // The principle is similar to insertion
-        cache->removeItemByWord(word);
+                if (ready.empty()) return;
 
-        // log("[Trie]: Removed word \"" + word + "\"", RED);
+                connection = ready.front();
+                ready.pop();
+            }
+
+            serve(connection);
+        }
     }
 
-    vector<string> suggest(const string& prefix, int wordLimit = 10) {
-        // Check if the prefix is in the cache
-		// Remove this part to test the trie without cache (used for performance testing)
-        // ---------------------------------------------------------------------------------------------- //
-        if (enableLogging) {
-            vector<string> cachedSuggestions = cache->get(prefix);
-            if (!cachedSuggestions.empty() && cachedSuggestions.size() >= wordLimit) {
-                log("[Trie]: Found prefix \"" + prefix + "\" in cache", YELLOW);
-                cache->update(prefix, cachedSuggestions, false, true);
-
-                // Substring the cached suggestions to the word limit
-                if (cachedSuggestions.size() > wordLimit) {
-                    return vector<string>(cachedSuggestions.begin(), cachedSuggestions.begin() + wordLimit);
+    void acceptConnections() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+
+            Connection* connection = new Connection(fd);
+            {
+                lock_guard<mutex> lock(connectionsLock);
+                connections.insert(connection);
+            }
+
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            event.data.ptr = connection;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+    }
+
+public:
+    QueryServer(Trie& trie, const string& path, unsigned workerCount = 0)
+        : trie(trie), path(path), workerCount(workerCount ? workerCount : max(1u, thread::hardware_concurrency())), enableLogging(true),
+        listenFd(-1), epollFd(-1), wakeFd(-1), stopping(false), served(0) {
+
+        for (auto& bucket : latencies) bucket = 0;
+    }
+
+    void setLogging(bool enable) {
+        enableLogging = enable;
+    }
+
+    // Bind the socket. A socket left at the path by an earlier server is replaced, any other
+    // file is left alone and the server does not start
+    bool open() {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(address.sun_path)) {
+            if (enableLogging) log("[Server]: Socket path is too long", RED);
+            return false;
+        }
+        strcpy(address.sun_path, path.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            if (enableLogging) log("[Server]: Cannot create a socket: " + string(strerror(errno)), RED);
+            return false;
+        }
+
+        struct stat info;
+        if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path.c_str());
+
+        if (bind(listenFd, (sockaddr*)&address, sizeof(address)) < 0) {
+            if (enableLogging) log("[Server]: Cannot bind " + path + ": " + strerror(errno), RED);
+
+            // The path is not ours, so the destructor must not unlink it
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+
+        if (listen(listenFd, SOMAXCONN) < 0) {
+            if (enableLogging) log("[Server]: Cannot listen on " + path + ": " + strerror(errno), RED);
+            return false;
+        }
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        // The listening socket and the wake-up are told apart from connections by their pointers
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = &listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+        event.data.ptr = &wakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+        return true;
+    }
+
+    // Serve until stop() is called
+    void run() {
+        trie.setConcurrentReads(true);
+        started = steady_clock::now();
+
+        for (unsigned t = 0; t < workerCount; t++) {
+            workers.emplace_back([this]() { work(); });
+        }
+
+        epoll_event events[64];
+        bool running = true;
+
+        while (running) {
+            int count = epoll_wait(epollFd, events, 64, -1);
+            if (count < 0 && errno != EINTR) break;
+
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.ptr == &listenFd) acceptConnections();
+                else if (events[i].data.ptr == &wakeFd) running = false;
+                else {
+                    lock_guard<mutex> lock(readyLock);
+                    ready.push((Connection*)events[i].data.ptr);
+                    readyChanged.notify_one();
                 }
+            }
+        }
 
-                return cachedSuggestions;
+        {
+            lock_guard<mutex> lock(readyLock);
+            stopping = true;
+        }
+        readyChanged.notify_all();
+
+        for (thread& worker : workers) worker.join();
+        workers.clear();
+
+        for (Connection* connection : connections) {
+            ::close(connection->fd);
+            delete connection;
+        }
+        connections.clear();
+
+        trie.setConcurrentReads(false);
+        if (enableLogging) log("[Server]: Stopped, " + statistics(), GREEN);
+    }
+
+    void stop() {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) return;
+    }
+
+    // "requests=<n> seconds=<s> qps=<n> p50us=<n> p90us=<n> p99us=<n>"
+    string statistics() {
+        uint64_t total = served;
+        double seconds = duration_cast<microseconds>(steady_clock::now() - started).count() / 1e6;
+
+        string text = "requests=" + to_string(total) + " seconds=" + to_string(seconds) + " qps=" + to_string((uint64_t)(total / max(seconds, 1e-6)));
+
+        for (int percentile : { 50, 90, 99 }) {
+            uint64_t target = (total * percentile + 99) / 100, seen = 0;
+            int bucket = 0;
+
+            while (bucket < LATENCY_BUCKETS - 1 && (seen += latencies[bucket]) < target) bucket++;
+            text += " p" + to_string(percentile) + "us=" + to_string(bucketLatency(bucket) / 1000.0);
+        }
+
+        return text;
+    }
+
+    ~QueryServer() {
+        if (listenFd >= 0) {
+            ::close(listenFd);
+            unlink(path.c_str());
+        }
+        if (epollFd >= 0) ::close(epollFd);
+        if (wakeFd >= 0) ::close(wakeFd);
+    }
+};
+
+// Server stopped by SIGINT or SIGTERM in --serve mode
+QueryServer* activeServer = nullptr;
+
+void stopServer(int) {
+    if (activeServer) activeServer->stop();
+}
+#endif
+
+// Headless batch mode. Reads one query per line: "prefix <prefix>", "regex <pattern>" or
+// "fuzzy <query> [distance]", and a line with a single word is a prefix. Writes one line per
+// query in the input order, as TSV (type, query, then the words) or as JSON lines.
+// Lines are handled in blocks: the prefixes of a block go through suggestBatch together, and
+// the output is written with one fwrite per megabyte instead of a flush per line. With more
+// than one worker, a reader thread cuts the input into blocks, the workers answer them and
+// the calling thread writes them back in order. The trie must not change meanwhile
+class BatchQueries {
+private:
+    static const size_t BLOCK_LINES = 4096;
+    static const size_t OUTPUT_BUFFER = 1 << 20;
+
+    Trie& trie;
+    int wordLimit;
+    bool json;
+    unsigned workerCount;
+
+    struct Block {
+        size_t sequence;
+        vector<string> lines;
+        string output;
+    };
+
+    // Input left over from the last read, up to the end of the last whole line
+    FILE* input;
+    string carry;
+    bool inputEnded;
+
+    static string jsonString(const string& text) {
+        string quoted = "\"";
+
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                quoted += '\\';
+                quoted += c;
+            }
+            else if ((unsigned char)c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
             }
+            else quoted += c;
         }
-		// ---------------------------------------------------------------------------------------------- //
 
-        // If the prefix is not in the cache, search the trie
-        bool isRegex = hasWildcard(prefix);
-        vector<string> results;
+        return quoted + "\"";
+    }
 
-        // If the prefix is not a regex, search the trie as usual
-        if (!isRegex) {
-            TrieNode* currentNode = searchPrefix(prefix);
+    // Read up to BLOCK_LINES lines. Returns false once the input is exhausted
+    bool readBlock(vector<string>& lines) {
+        lines.clear();
+        size_t position = 0;
 
-			comparisons++;
-            if (currentNode) {
-                string currentWord = prefix;
-                suggestHelper(results, currentNode, currentWord, wordLimit);
+        while (lines.size() < BLOCK_LINES) {
+            size_t newline = carry.find('\n', position);
+
+            if (newline == string::npos) {
+                carry.erase(0, position);
+                position = 0;
+
+                if (inputEnded) {
+                    if (!carry.empty()) lines.push_back(carry);
+                    carry.clear();
+                    break;
+                }
+
+                char buffer[1 << 16];
+                size_t count = fread(buffer, 1, sizeof(buffer), input);
+
+                if (count == 0) inputEnded = true;
+                carry.append(buffer, count);
+                continue;
             }
 
-            // Otherwise, search the trie by regex
+            lines.push_back(carry.substr(position, newline - position));
+            if (!lines.back().empty() && lines.back().back() == '\r') lines.back().pop_back();
+            position = newline + 1;
         }
-        else {
-            string targetWord = prefix;
-            string currentWord = "";
-            searchByRegex(results, targetWord, root, currentWord, wordLimit);
+
+        carry.erase(0, position);
+        return !lines.empty();
+    }
+
+    void writeResult(string& output, const string& type, const string& query, int distance, const vector<string>& words) {
+        if (json) {
+            output += "{\"type\":\"" + type + "\",\"query\":" + jsonString(query);
+            if (type == "fuzzy") output += ",\"distance\":" + to_string(distance);
+            output += ",\"results\":[";
+
+            for (size_t i = 0; i < words.size(); i++) {
+                output += i ? ",\"" : "\"";
+                output += words[i];
+                output += '"';
+            }
+            output += "]}\n";
+            return;
         }
 
-        // Update the cache
-        // Remove this part to test the trie without cache (used for performance testing)
-        // ---------------------------------------------------------------------------------------------- //
-        if (enableLogging) {
-            if (cache->getSize() > cache->getCapacity()) cache->evict();
-            cache->insert(prefix, results);
+        output += type;
+        output += '\t';
+        output += query;
+
+        for (const string& word : words) {
+            output += '\t';
+            output += word;
         }
-        // ---------------------------------------------------------------------------------------------- //
+        output += '\n';
+    }
 
-        return results;
+    void writeError(string& output, const string& line, const string& reason) {
+        if (json) output += "{\"error\":" + jsonString(reason) + ",\"line\":" + jsonString(line) + "}\n";
+        else output += "error\t" + reason + '\t' + line + '\n';
     }
 
-    vector<string> fuzzySearch(string& query, int maxDistance = 1, int wordLimit = 10) {
-        // Check if the query is in the cache
-        vector<string> cachedSuggestions = cache->get(query);
-        if (!cachedSuggestions.empty() && cachedSuggestions.size() >= wordLimit) {
-            log("[Trie]: Found query \"" + query + "\" in cache", YELLOW);
-            cache->update(query, cachedSuggestions, false, true);
+    void answer(Block& block) {
+        struct Query {
+            string type;
+            string text;
+            int distance;
+        };
 
-            // Substring the cached suggestions to the word limit
-            if (cachedSuggestions.size() > wordLimit) {
-                return vector<string>(cachedSuggestions.begin(), cachedSuggestions.begin() + wordLimit);
+        vector<Query> queries;
+        vector<string> prefixes;
+        vector<size_t> prefixLines;
+        vector<string> errors(block.lines.size());
+
+        for (size_t i = 0; i < block.lines.size(); i++) {
+            const string& line = block.lines[i];
+            vector<string> args;
+
+            for (size_t start = 0; start < line.size(); ) {
+                size_t end = line.find_first_of(" \t", start);
+                if (end == string::npos) end = line.size();
+                if (end > start) args.push_back(line.substr(start, end - start));
+                start = end + 1;
+            }
+
+            Query query = { "", "", 1 };
+            if (args.size() == 1) query = { "prefix", args[0], 0 };
+            else if (args.size() >= 2) query = { args[0], args[1], args[0] == "fuzzy" ? 1 : 0 };
+
+            if (args.empty()) {
+                // Blank lines are skipped
+            }
+            else if (query.type != "prefix" && query.type != "regex" && query.type != "fuzzy") errors[i] = "unknown type";
+            else if (args.size() > (query.type == "fuzzy" ? 3u : 2u)) errors[i] = "too many arguments";
+            else if (args.size() == 3 && (args[2].empty() || args[2].size() > 2 || args[2].find_first_not_of("0123456789") != string::npos)) {
+                errors[i] = "bad distance";
+            }
+            else {
+                if (args.size() == 3) query.distance = atoi(args[2].c_str());
+                if (query.type == "prefix") {
+                    prefixes.push_back(query.text);
+                    prefixLines.push_back(i);
+                }
             }
 
-            return cachedSuggestions;
+            queries.push_back(query);
         }
 
-        // If the query is not in the cache, search the trie
-        vector<pair<string, int>> results;
-        vector<int> currentRow(query.size() + 1);
+        // The prefixes of the block share their walks
+        vector<vector<string>> completions = trie.suggestBatch(prefixes, wordLimit);
+        vector<const vector<string>*> prefixResults(block.lines.size(), nullptr);
+        for (size_t k = 0; k < prefixLines.size(); k++) prefixResults[prefixLines[k]] = &completions[k];
+
+        for (size_t i = 0; i < block.lines.size(); i++) {
+            const Query& query = queries[i];
 
-        // Initialize the first row of the DP table. The query starts from index 1 since index 0 represents an empty string.
-        for (int i = 0; i <= query.size(); ++i) {
-            currentRow[i] = i;
+            if (!errors[i].empty()) writeError(block.output, block.lines[i], errors[i]);
+            else if (query.type.empty()) continue;
+            else if (query.type == "prefix") writeResult(block.output, query.type, query.text, 0, *prefixResults[i]);
+            else if (query.type == "regex") writeResult(block.output, query.type, query.text, 0, trie.suggest("(" + query.text + ")", wordLimit));
+            else writeResult(block.output, query.type, query.text, query.distance, trie.fuzzySearchBitParallel(query.text, query.distance, wordLimit));
         }
+    }
 
-        // Start recursive fuzzy matching
-        string currentWord = "";
-        for (int i = 0; i < 26; ++i) {
-            if (root->children[i]) {
-                currentWord.push_back('a' + i);
-                fuzzySearchHelper(root->children[i], query, maxDistance, currentRow, currentWord, results);
-                currentWord.pop_back();
+public:
+    BatchQueries(Trie& trie, int wordLimit = 10, bool json = false, unsigned workerCount = 1)
+        : trie(trie), wordLimit(wordLimit), json(json), workerCount(max(1u, workerCount)), input(nullptr), inputEnded(false) {}
+
+    // Answer every query of the input. Returns the number of lines read
+    size_t run(FILE* input, FILE* output) {
+        this->input = input;
+        carry.clear();
+        inputEnded = false;
+
+        size_t lineCount = 0;
+        string buffered;
+
+        auto write = [&](const string& text, bool last) {
+            buffered += text;
+            if (buffered.size() >= OUTPUT_BUFFER || last) {
+                fwrite(buffered.data(), 1, buffered.size(), output);
+                buffered.clear();
+            }
+        };
+
+        if (workerCount == 1) {
+            Block block = { 0, {}, "" };
+
+            while (readBlock(block.lines)) {
+                lineCount += block.lines.size();
+                block.output.clear();
+                answer(block);
+                write(block.output, false);
+            }
+
+            write("", true);
+            fflush(output);
+            return lineCount;
+        }
+
+        // The readers, workers and writer share one lock. At most "window" blocks are read and
+        // not yet written, which bounds the memory however far the writer falls behind
+        mutex lock;
+        condition_variable changed;
+        queue<Block*> waiting;
+        map<size_t, Block*> finished;
+        size_t read = 0, written = 0, window = 4 * workerCount;
+        bool ended = false;
+
+        thread reader([&]() {
+            while (true) {
+                Block* block = new Block{ read, {}, "" };
+
+                if (!readBlock(block->lines)) {
+                    delete block;
+                    break;
+                }
+
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&]() { return read - written < window; });
+
+                lineCount += block->lines.size();
+                waiting.push(block);
+                read++;
+                changed.notify_all();
+            }
+
+            lock_guard<mutex> guard(lock);
+            ended = true;
+            changed.notify_all();
+        });
+
+        vector<thread> workers;
+        for (unsigned t = 0; t < workerCount; t++) {
+            workers.emplace_back([&]() {
+                while (true) {
+                    Block* block;
+                    {
+                        unique_lock<mutex> guard(lock);
+                        changed.wait(guard, [&]() { return ended || !waiting.empty(); });
+
+                        if (waiting.empty()) return;
+
+                        block = waiting.front();
+                        waiting.pop();
+                    }
+
+                    answer(*block);
+
+                    lock_guard<mutex> guard(lock);
+                    finished[block->sequence] = block;
+                    changed.notify_all();
+                }
+            });
+        }
+
+        while (true) {
+            Block* block;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&]() { return finished.count(written) || (ended && written == read); });
+
+                if (!finished.count(written)) break;
+
+                block = finished[written];
+                finished.erase(written);
+            }
+
+            write(block->output, false);
+            delete block;
+
+            lock_guard<mutex> guard(lock);
+            written++;
+            changed.notify_all();
+        }
+
+        reader.join();
+        for (thread& worker : workers) worker.join();
+
+        write("", true);
+        fflush(output);
+        return lineCount;
+    }
+};
+
+// Allocations made through operator new by the current thread, read by Benchmark. The
+// counter is per thread so that counting costs nothing shared. Only builds defining
+// TRIE_COUNT_ALLOCATIONS count: every form of new and delete is then replaced, so that
+// they all count and pair up with each other. Other builds keep the library allocator
+thread_local uint64_t allocationCount = 0;
+
+#ifdef TRIE_COUNT_ALLOCATIONS
+// Out of line, so that the compiler never sees malloc() or free() where a new expression
+// is paired with its delete, and reports the pairs as mismatched
+#ifdef _MSC_VER
+#define ALLOCATOR_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATOR_NOINLINE __attribute__((noinline))
+#endif
+
+static void* countedAllocation(size_t size) {
+    allocationCount++;
+    return malloc(size ? size : 1);
+}
+
+ALLOCATOR_NOINLINE void* operator new(size_t size, const nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+
+ALLOCATOR_NOINLINE void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+
+ALLOCATOR_NOINLINE void* operator new(size_t size) {
+    void* memory = countedAllocation(size);
+    if (!memory) throw bad_alloc();
+
+    return memory;
+}
+
+ALLOCATOR_NOINLINE void* operator new[](size_t size) {
+    void* memory = countedAllocation(size);
+    if (!memory) throw bad_alloc();
+
+    return memory;
+}
+
+ALLOCATOR_NOINLINE void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+ALLOCATOR_NOINLINE void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+ALLOCATOR_NOINLINE void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+ALLOCATOR_NOINLINE void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+ALLOCATOR_NOINLINE void operator delete(void* memory, const nothrow_t&) noexcept {
+    free(memory);
+}
+
+ALLOCATOR_NOINLINE void operator delete[](void* memory, const nothrow_t&) noexcept {
+    free(memory);
+}
+#endif
+
+// Only the trie has a cache, the measurements keep it out
+void disableCaching(Trie& trie) {
+    trie.setCaching(false);
+}
+
+template <typename Other>
+void disableCaching(Other&) {}
+
+// Micro-benchmarks of the dictionary structures. Every operation is timed on its own in
+// nanoseconds, less the cost of reading the clock, after an untimed warm-up, and summed up
+// as throughput, mean and p50/p90/p99/p99.9 latencies, with the allocations per operation
+// in builds defining TRIE_COUNT_ALLOCATIONS. The words and prefixes are read once, and a dictionary of each size is sampled evenly
+// from the words. Results can be written as CSV or JSON to compare builds
+class Benchmark {
+public:
+    struct Result {
+        string backend;
+        string operation;
+        size_t dictionarySize;
+
+        // 0 for insert and remove
+        int wordLimit;
+        size_t operations;
+        double operationsPerSecond;
+
+        // Nanoseconds
+        double mean, p50, p90, p99, p999;
+
+        // -1 unless allocations are counted, see allocationCount
+        double allocationsPerOperation;
+    };
+
+private:
+    vector<string> words;
+    vector<string> prefixes;
+    vector<Result> results;
+    bool enableLogging;
+    double clockOverhead;
+
+#ifdef TRIE_COUNT_ALLOCATIONS
+    static const bool COUNTS_ALLOCATIONS = true;
+#else
+    static const bool COUNTS_ALLOCATIONS = false;
+#endif
+
+    // Structures built in one go are only measured on suggest
+    template <typename Dictionary>
+    static bool isStatic(Dictionary&) {
+        return false;
+    }
+
+    static bool isStatic(Dafsa&) {
+        return true;
+    }
+
+    static bool isStatic(LoudsTrie&) {
+        return true;
+    }
+
+    template <typename Dictionary>
+    static void insertWord(Dictionary& dictionary, const string& word) {
+        dictionary.insert(word);
+    }
+
+    template <typename Dictionary>
+    static void removeWord(Dictionary& dictionary, const string& word) {
+        dictionary.remove(word);
+    }
+
+    static void insertWord(Dafsa&, const string&) {}
+    static void removeWord(Dafsa&, const string&) {}
+    static void insertWord(LoudsTrie&, const string&) {}
+    static void removeWord(LoudsTrie&, const string&) {}
+
+    static void fill(Dafsa& dafsa, const vector<string>& sample) {
+        dafsa.build(sample);
+    }
+
+    static void fill(LoudsTrie& louds, const vector<string>& sample) {
+        Trie trie;
+        trie.setLogging(false);
+        disableCaching(trie);
+
+        for (const string& word : sample) trie.insert(word);
+        louds = trie.freeze();
+    }
+
+    template <typename Dictionary>
+    static void fill(Dictionary& dictionary, const vector<string>& sample) {
+        for (const string& word : sample) insertWord(dictionary, word);
+    }
+
+    // Nearest rank of sorted samples
+    static double percentile(const vector<double>& sorted, double p) {
+        size_t rank = (size_t)ceil(p / 100 * sorted.size());
+        return sorted[max<size_t>(1, min(rank, sorted.size())) - 1];
+    }
+
+    static string format(double value, int decimals) {
+        char text[64];
+        snprintf(text, sizeof(text), "%.*f", decimals, value);
+        return text;
+    }
+
+    vector<string> sample(size_t size) {
+        if (size == 0 || size >= words.size()) return words;
+
+        vector<string> sampled;
+        for (size_t i = 0; i < size; i++) sampled.push_back(words[i * words.size() / size]);
+
+        return sampled;
+    }
+
+    // Time operation(i) for every i below count
+    template <typename Operation>
+    void measure(const string& backend, const string& name, size_t size, int wordLimit, size_t count, Operation operation) {
+        if (count == 0) return;
+
+        vector<double> samples(count);
+        uint64_t allocations = allocationCount;
+        auto begin = steady_clock::now();
+
+        for (size_t i = 0; i < count; i++) {
+            auto start = steady_clock::now();
+            operation(i);
+            samples[i] = max(0.0, duration<double, nano>(steady_clock::now() - start).count() - clockOverhead);
+        }
+
+        double seconds = duration<double>(steady_clock::now() - begin).count();
+        allocations = allocationCount - allocations;
+
+        double total = 0;
+        for (double sample : samples) total += sample;
+        sort(samples.begin(), samples.end());
+
+        Result result = { backend, name, size, wordLimit, count, count / max(seconds, 1e-9), total / count,
+            percentile(samples, 50), percentile(samples, 90), percentile(samples, 99), percentile(samples, 99.9), COUNTS_ALLOCATIONS ? (double)allocations / count : -1 };
+        results.push_back(result);
+
+        if (enableLogging) {
+            log("[Benchmark]: " + backend + " " + name + ", " + to_string(size) + " words" + (wordLimit ? ", limit " + to_string(wordLimit) : "") + ": " +
+                format(result.operationsPerSecond, 0) + " ops/s, mean " + format(result.mean, 0) + " ns, p50 " + format(result.p50, 0) +
+                " ns, p90 " + format(result.p90, 0) + " ns, p99 " + format(result.p99, 0) + " ns, p99.9 " + format(result.p999, 0) + " ns" +
+                (COUNTS_ALLOCATIONS ? ", " + format(result.allocationsPerOperation, 2) + " allocations/op" : ""), GREEN);
+        }
+    }
+
+public:
+    Benchmark(const vector<string>& words, const vector<string>& prefixes) : words(words), prefixes(prefixes), enableLogging(true) {
+        // Median cost of reading the clock twice
+        vector<double> empty(1001);
+        for (double& sample : empty) {
+            auto start = steady_clock::now();
+            sample = duration<double, nano>(steady_clock::now() - start).count();
+        }
+
+        sort(empty.begin(), empty.end());
+        clockOverhead = empty[empty.size() / 2];
+    }
+
+    void setLogging(bool enable) {
+        enableLogging = enable;
+    }
+
+    const vector<Result>& getResults() {
+        return results;
+    }
+
+    // Insert the sampled words one at a time, suggest every prefix with each word limit,
+    // then remove the words again. A size of 0 takes every word
+    template <typename Dictionary>
+    void run(const string& backend, const vector<size_t>& sizes, const vector<int>& wordLimits) {
+        for (size_t size : sizes) {
+            vector<string> sampled = sample(size);
+            size = sampled.size();
+
+            Dictionary dictionary;
+            dictionary.setLogging(false);
+            disableCaching(dictionary);
+
+            if (isStatic(dictionary)) fill(dictionary, sampled);
+            else {
+                // Build one dictionary first to warm up the allocator and the caches
+                {
+                    Dictionary warmUp;
+                    warmUp.setLogging(false);
+                    disableCaching(warmUp);
+                    fill(warmUp, sampled);
+                }
+
+                measure(backend, "insert", size, 0, sampled.size(), [&](size_t i) { insertWord(dictionary, sampled[i]); });
+            }
+
+            for (int wordLimit : wordLimits) {
+                for (const string& prefix : prefixes) dictionary.suggest(prefix, wordLimit);
+                measure(backend, "suggest", size, wordLimit, prefixes.size(), [&](size_t i) { dictionary.suggest(prefixes[i], wordLimit); });
+            }
+
+            if (!isStatic(dictionary)) {
+                measure(backend, "remove", size, 0, sampled.size(), [&](size_t i) { removeWord(dictionary, sampled[i]); });
             }
         }
+    }
 
-        // Sort the results by Levenshtein distance
-        sort(results.begin(), results.end(), [](const pair<string, int>& a, const pair<string, int>& b) {
-            return a.second < b.second;
-            });
+    void writeCsv(ostream& out) {
+        out << "backend,operation,dictionary_size,word_limit,operations,ops_per_second,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,allocations_per_op\n";
 
-        // Resize the results to the word limit
-        vector<string> finalResults;
-        for (int i = 0; i < results.size() && i < wordLimit; i++) {
-            finalResults.push_back(results[i].first);
+        for (const Result& r : results) {
+            out << r.backend << ',' << r.operation << ',' << r.dictionarySize << ',' << r.wordLimit << ',' << r.operations << ','
+                << format(r.operationsPerSecond, 1) << ',' << format(r.mean, 1) << ',' << format(r.p50, 1) << ',' << format(r.p90, 1) << ','
+                << format(r.p99, 1) << ',' << format(r.p999, 1) << ',' << (COUNTS_ALLOCATIONS ? format(r.allocationsPerOperation, 3) : "") << '\n';
         }
+    }
 
-        // Update the cache
-        if (cache->getSize() > cache->getCapacity()) cache->evict();
-        cache->insert(query, finalResults);
+    // One array of objects with the same fields as the CSV columns
+    void writeJson(ostream& out) {
+        out << "[\n";
 
-        return finalResults;
-    }
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
 
-    void releaseTrie() {
-        clearTrie(root);
-        cache->clearCache();
-    }
+            out << "  {\"backend\":\"" << r.backend << "\",\"operation\":\"" << r.operation << "\",\"dictionary_size\":" << r.dictionarySize
+                << ",\"word_limit\":" << r.wordLimit << ",\"operations\":" << r.operations << ",\"ops_per_second\":" << format(r.operationsPerSecond, 1)
+                << ",\"mean_ns\":" << format(r.mean, 1) << ",\"p50_ns\":" << format(r.p50, 1) << ",\"p90_ns\":" << format(r.p90, 1)
+                << ",\"p99_ns\":" << format(r.p99, 1) << ",\"p999_ns\":" << format(r.p999, 1)
+                << ",\"allocations_per_op\":" << (COUNTS_ALLOCATIONS ? format(r.allocationsPerOperation, 3) : "null") << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
 
-    ~Trie() {
-        releaseTrie();
+        out << "]\n";
     }
 };
 
@@ -616,7 +6377,34 @@ private:
         testEmptiness();
         testSuggestNoRegex();
         testSuggestWithRegex();
+        testRegexOperators();
         testFuzzySearch();
+        testFuzzyAutomaton();
+        testFuzzyBitParallel();
+        testFuzzyBestFirst();
+        testSuggestBatch();
+        testBatchQueries();
+        testBenchmark();
+#ifdef __linux__
+        testQueryServer();
+#endif
+        testDeletionIndex();
+        testNodePool();
+        testSparseChildren();
+        testRadixTrie();
+        testFreeze();
+        testSnapshot();
+        testParallelLoad();
+        testBuildFromSorted();
+        testRankedSuggest();
+        testConcurrentReads();
+        testCacheManager();
+        testCacheInvalidation();
+        testCompletionSession();
+        testSuggestInto();
+        testCompletionIterator();
+        testDoubleArray();
+        testDafsa();
         log("[Unit Test]: All tests passed", GREEN);
     }
 
@@ -788,6 +6576,73 @@ private:
         log("[Unit Test]: Suggest with regex: 10 test cases passed");
     }
 
+    // Test the regex operators and that every structure walks the automaton the same way
+    void testRegexOperators() {
+        RegexAutomaton regex;
+
+        bool rejected = true;
+        for (string pattern : { "a(b", "[ab", "*a", "a)", "a|+b", "(?)" }) {
+            rejected = rejected && !regex.compile(pattern);
+        }
+        assert(rejected);
+
+        assert(regex.compile("colou?r") && regex.matches("color") && regex.matches("colour") && !regex.matches("colouur"));
+        assert(regex.compile("(ab)+") && regex.matches("abab") && !regex.matches("aba") && !regex.matches(""));
+        assert(regex.compile("c(at|ow)s?") && regex.matches("cows") && regex.matches("cat") && !regex.matches("cas"));
+        assert(regex.compile("^a.*z$") && regex.matches("az") && regex.matches("abcz") && !regex.matches("abc"));
+        assert(regex.compile("a$b") && regex.start() != RegexAutomaton::DEAD && !regex.matches("ab") && !regex.matches("a"));
+
+        assert(regex.compile("(ab|cd)[^x]") && regex.fixedLength() == 3);
+        assert(regex.compile("a|bc") && regex.fixedLength() == -1);
+
+        vector<string> words = { "a", "ab", "abab", "abc", "abcz", "az", "cat", "cats", "color", "colour", "cow", "cows", "dog", "zebra" };
+        Trie trie;
+        RadixTrie radixTrie;
+        DoubleArrayTrie doubleArray;
+        Dafsa dafsa;
+
+        trie.setLogging(false);
+        radixTrie.setLogging(false);
+        doubleArray.setLogging(false);
+        dafsa.setLogging(false);
+
+        for (const string& word : words) {
+            trie.insert(word);
+            radixTrie.insert(word);
+            doubleArray.insert(word);
+        }
+        dafsa.build(words);
+
+        LoudsTrie frozen = trie.freeze();
+        frozen.setLogging(false);
+
+        bool same = true;
+        for (string pattern : { "a.*", "c(at|ow)s?", "(ab)*", "[^c]..", "colou?r|dog", "a+b?", ".*z.*", "^.$", "a$b", "a^b" }) {
+            vector<string> expected;
+
+            regex.compile(pattern);
+            for (const string& word : words) {
+                if (regex.matches(word)) expected.push_back(word);
+            }
+
+            same = same && trie.suggest(pattern, 20) == expected && radixTrie.suggest(pattern, 20) == expected &&
+                doubleArray.suggest(pattern, 20) == expected && dafsa.suggest(pattern, 20) == expected && frozen.suggest(pattern, 20) == expected;
+        }
+        assert(same);
+
+        // Deep nesting is rejected instead of overflowing the stack, and a long chain of
+        // quantifiers is walked without recursion
+        string nested = string(30000, '(') + "a" + string(30000, ')');
+        assert(!regex.compile(nested) && trie.suggest(nested, 5).empty());
+        assert(regex.compile(string(RegexAutomaton::MAX_NESTING, '(') + "a" + string(RegexAutomaton::MAX_NESTING, ')')));
+
+        string optional;
+        for (int i = 0; i < 200000; i++) optional += "a?";
+        assert(trie.suggest(optional, 5) == vector<string>({ "a" }));
+
+        log("[Unit Test]: Regex operators: 13 test cases passed");
+    }
+
     // Test fuzzy search
     void testFuzzySearch() {
         Trie trie;
@@ -826,186 +6681,1261 @@ private:
         assert(suggestions2[3] == "ctr");
         assert(suggestions2[4] == "ear");
 
-        log("[Unit Test]: Fuzzy search: 8 test cases passed");
-    }
+        log("[Unit Test]: Fuzzy search: 8 test cases passed");
+    }
+
+    // Test that the Levenshtein automaton gives the same results as fuzzySearch
+    void testFuzzyAutomaton() {
+        LevenshteinAutomaton automaton("kitten", 3);
+        int state = automaton.start();
+        for (char c : string("sitting")) state = automaton.step(state, c);
+        assert(state != LevenshteinAutomaton::DEAD && automaton.distance(state) == 3);
+
+        LevenshteinAutomaton strict("kitten", 1);
+        state = strict.start();
+        for (char c : string("xy")) if (state != LevenshteinAutomaton::DEAD) state = strict.step(state, c);
+        assert(state == LevenshteinAutomaton::DEAD);
+
+        Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
+
+        vector<string> words = { "apple", "apa", "banana", "app", "application", "mango", "apprehensive", "car", "clr", "cat", "cart", "bandana", "a" };
+        for (const string& word : words) trie.insert(word);
+
+        bool same = true;
+        for (string query : { "apple", "aple", "banan", "car", "xyz", "", "applications" }) {
+            for (int distance = 0; distance <= 3; distance++) {
+                same = same && trie.fuzzySearchAutomaton(query, distance, 3) == trie.fuzzySearch(query, distance, 3);
+                same = same && trie.fuzzySearchAutomaton(query, distance, 100) == trie.fuzzySearch(query, distance, 100);
+            }
+        }
+        assert(same);
+
+        // Every backend lists the words at the same distance alphabetically, also when there
+        // are too many of them for the sort to keep the order by chance
+        vector<string> neighbours;
+        for (char c = 'a'; c <= 'z'; c++) {
+            neighbours.push_back(string("b") + c + "t");
+            neighbours.push_back(string("ba") + c);
+        }
+        sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+        Trie reference;
+        RadixTrie radixTrie;
+        DoubleArrayTrie doubleArray;
+        Dafsa dafsa;
+
+        reference.setLogging(false);
+        reference.setCaching(false);
+        radixTrie.setLogging(false);
+        doubleArray.setLogging(false);
+        dafsa.setLogging(false);
+
+        for (const string& word : neighbours) {
+            reference.insert(word);
+            radixTrie.insert(word);
+            doubleArray.insert(word);
+        }
+        dafsa.build(neighbours);
+
+        LoudsTrie frozen = reference.freeze();
+        frozen.setLogging(false);
+
+        string query = "bat";
+        vector<string> expected = reference.fuzzySearch(query, 1, 100);
+        assert(expected.size() == neighbours.size() && radixTrie.fuzzySearch(query, 1, 100) == expected &&
+            doubleArray.fuzzySearch(query, 1, 100) == expected && dafsa.fuzzySearch(query, 1, 100) == expected &&
+            frozen.fuzzySearch(query, 1, 100) == expected);
+
+        log("[Unit Test]: Fuzzy automaton: 4 test cases passed");
+    }
+
+    // Test the bit-parallel kernel against the scalar distances, also past 64 letters
+    void testFuzzyBitParallel() {
+        vector<string> samples = { "", "a", "teh", "the", "abcdef", "badcfe", "kitten", "sitting", "ca", "abc", "acb", "ab" };
+        string longWord, longTypo;
+        for (int i = 0; i < 150; i++) longWord += 'a' + (i * 7) % 26;
+        longTypo = longWord;
+        swap(longTypo[70], longTypo[71]);
+        longTypo.erase(130, 1);
+        samples.push_back(longWord);
+        samples.push_back(longTypo);
+
+        bool same = true;
+        for (bool transpositions : { false, true }) {
+            for (const string& query : samples) {
+                EditDistanceKernel kernel(query, transpositions);
+                vector<uint64_t> previous(kernel.stride()), next(kernel.stride());
+
+                for (const string& word : samples) {
+                    int distance = query.size();
+                    char last = 0;
+
+                    kernel.init(&previous[0]);
+                    for (char c : word) {
+                        distance = kernel.step(&previous[0], last, c, &next[0], distance);
+                        swap(previous, next);
+                        last = c;
+                    }
+
+                    same = same && distance == editDistance(query, word, transpositions);
+                }
+            }
+        }
+        assert(same);
+        assert(editDistance(longWord, longTypo, true) == 2 && editDistance("teh", "the", true) == 1);
+
+        Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
+
+        vector<string> words = { "apple", "apa", "banana", "app", "application", "mango", "apprehensive", "car", "clr", "cat", "cart", "the", "then", "a" };
+        for (const string& word : words) trie.insert(word);
+
+        same = true;
+        for (string query : { "apple", "aple", "banan", "car", "xyz", "", "applications", "teh" }) {
+            for (int distance = 0; distance <= 3; distance++) {
+                same = same && trie.fuzzySearchBitParallel(query, distance, 100) == trie.fuzzySearch(query, distance, 100);
+                same = same && trie.fuzzySearchBitParallel(query, distance, 3) == trie.fuzzySearch(query, distance, 3);
+            }
+        }
+        assert(same);
+
+        string typo = "teh";
+        assert(trie.fuzzySearch(typo, 1).empty());
+        assert(trie.fuzzySearchBitParallel("teh", 1, 10, true) == vector<string>({ "the" }));
+
+        log("[Unit Test]: Fuzzy bit-parallel: 6 test cases passed");
+    }
+
+    // Test that the best-first search gives fuzzySearch's results in the same order
+    void testFuzzyBestFirst() {
+        Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
+
+        vector<string> words = { "apple", "apa", "banana", "app", "application", "mango", "apprehensive", "car", "clr", "cat", "cart", "care", "a", "ap" };
+        for (const string& word : words) trie.insert(word);
+
+        bool same = true;
+        for (string query : { "apple", "aple", "banan", "car", "xyz", "", "applications", "ca" }) {
+            for (int distance = 0; distance <= 3; distance++) {
+                for (int limit : { 1, 3, 100 }) {
+                    same = same && trie.fuzzySearchBestFirst(query, distance, limit) == trie.fuzzySearch(query, distance, limit);
+                }
+            }
+        }
+        assert(same);
+
+        // Closer words first, ties in alphabetical order
+        assert(trie.fuzzySearchBestFirst("car", 1, 4) == vector<string>({ "car", "care", "cart", "cat" }));
+        assert(trie.fuzzySearchBestFirst("car", 1, 0).empty());
+
+        log("[Unit Test]: Fuzzy best first: 3 test cases passed");
+    }
+
+#ifdef __linux__
+    // Test the query server on a local socket, with pipelined and length-prefixed requests
+    void testQueryServer() {
+        Trie trie;
+        trie.setLogging(false);
+
+        vector<string> words = { "apple", "app", "application", "car", "cat", "cart", "care" };
+        for (const string& word : words) trie.insert(word);
+
+        string path = "/tmp/trie_test_" + to_string(getpid()) + ".sock";
+        QueryServer server(trie, path, 2);
+        server.setLogging(false);
+        assert(server.open());
+
+        thread serving([&server]() { server.run(); });
+
+        // Send the requests in one write and read as many bytes as the expected answers,
+        // up to the end of a line if they end with one
+        auto exchange = [&path](const string& requests, const string& expected) {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            timeval timeout = { 5, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            strcpy(address.sun_path, path.c_str());
+
+            string received;
+            if (connect(fd, (sockaddr*)&address, sizeof(address)) == 0 && write(fd, requests.data(), requests.size()) == (ssize_t)requests.size()) {
+                char buffer[4096];
+                ssize_t count;
+
+                while ((received.size() < expected.size() || (expected.back() == '\n' && received.back() != '\n')) &&
+                    (count = read(fd, buffer, sizeof(buffer))) > 0) {
+                    received.append(buffer, count);
+                }
+            }
+
+            close(fd);
+            return received;
+        };
+
+        // Pipelined requests are answered in order
+        string expected = "ok car care\nok cat car cart\nok car cat\nok\n";
+        assert(exchange("suggest ca 2\nfuzzy cat 1 3\nregex ca.\nsuggest zz\n", expected) == expected);
+
+        // Writes are seen by the next request
+        expected = "ok\nok\nok cab care cart cat\n";
+        assert(exchange("insert cab\nremove car\nsuggest ca\n", expected) == expected);
+
+        // Length-prefixed requests, mixed with lines
+        expected = "*24\nok app apple application*10\nok app catok apple\n";
+        assert(exchange("*10\nsuggest ap*13\nregex app|catsuggest apple\n", expected) == expected);
+
+        // Errors are answered without closing the connection
+        expected = "error unknown command jump\nerror words are lowercase letters only\nerror bad limit\nok\nok app\n";
+        assert(exchange("jump\ninsert Car\nsuggest ap x\nsuggest Ap\nsuggest app 1\n", expected) == expected);
+
+        // A malformed length closes the connection
+        expected = "error malformed request\n";
+        assert(exchange("*x\nsuggest ap\n", expected) == expected);
+
+        // Statistics count the requests answered so far
+        assert(exchange("stats\n", "ok requests=15 \n").compare(0, 15, "ok requests=15 ") == 0);
+
+        // Patterns the regex parser would recurse too deep on are refused
+        expected = "error pattern too long\nerror pattern too long\n";
+        assert(exchange("regex " + string(30000, '(') + "a" + string(30000, ')') + "\nsuggest " + string(5000, 'a') + "\n", expected) == expected);
+
+        // A client that writes faster than it reads still gets every answer in order, the
+        // server stops reading while the answers pile up instead of buffering them all
+        string requests, answers;
+        for (int i = 0; i < 200000; i++) {
+            requests += "suggest ap 2\n";
+            answers += "ok app apple\n";
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        timeval timeout = { 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        assert(connect(fd, (sockaddr*)&address, sizeof(address)) == 0);
+
+        thread writer([fd, &requests]() {
+            for (size_t sent = 0; sent < requests.size();) {
+                ssize_t count = write(fd, requests.data() + sent, requests.size() - sent);
+                if (count <= 0) break;
+                sent += count;
+            }
+            });
+
+        // Start reading only once the server had time to fill its output
+        this_thread::sleep_for(milliseconds(200));
+
+        string received;
+        char buffer[65536];
+        ssize_t count;
+        while (received.size() < answers.size() && (count = read(fd, buffer, sizeof(buffer))) > 0) received.append(buffer, count);
+
+        writer.join();
+        close(fd);
+        assert(received == answers);
+
+        // A path that is not a socket is never replaced
+        string occupied = path + ".txt";
+        {
+            ofstream file(occupied);
+            file << "keep";
+        }
+
+        QueryServer blocked(trie, occupied, 1);
+        blocked.setLogging(false);
+        assert(blocked.open() == false);
+
+        ifstream kept(occupied);
+        string content;
+        getline(kept, content);
+        kept.close();
+        std::remove(occupied.c_str());
+        assert(content == "keep");
+
+        server.stop();
+        serving.join();
+
+        log("[Unit Test]: Query server: 10 test cases passed");
+    }
+#endif
+
+    // Test that the benchmark measures every operation and writes one row per result
+    void testBenchmark() {
+        vector<string> words = { "apple", "app", "application", "banana", "car", "cat", "cart", "care", "dog", "door" };
+        sort(words.begin(), words.end());
+
+        Benchmark benchmark(words, { "ap", "ca", "x", "d" });
+        benchmark.setLogging(false);
+        benchmark.run<Trie>("trie", { 5, 0 }, { 1, 10 });
+        benchmark.run<Dafsa>("dafsa", { 0 }, { 10 });
+        benchmark.run<LoudsTrie>("louds", { 0 }, { 10 });
+
+        // Insert, two suggests and remove for each size, suggest only for the static ones
+        const vector<Benchmark::Result>& results = benchmark.getResults();
+        assert(results.size() == 10 && results[9].backend == "louds" && results[9].operation == "suggest");
+        assert(results[0].operation == "insert" && results[0].dictionarySize == 5 && results[0].operations == 5);
+        assert(results[4].operation == "insert" && results[4].dictionarySize == 10 && results[6].wordLimit == 10 && results[8].backend == "dafsa");
+
+        bool ordered = true;
+        for (const Benchmark::Result& result : results) {
+            ordered = ordered && result.p50 <= result.p90 && result.p90 <= result.p99 && result.p99 <= result.p999 && result.operationsPerSecond > 0;
+        }
+        assert(ordered);
+
+        // Suggestions are returned in new vectors
+#ifdef TRIE_COUNT_ALLOCATIONS
+        assert(results[1].allocationsPerOperation > 0);
+#else
+        assert(results[1].allocationsPerOperation == -1);
+#endif
+
+        ostringstream csvStream, jsonStream;
+        benchmark.writeCsv(csvStream);
+        benchmark.writeJson(jsonStream);
+
+        string csv = csvStream.str(), json = jsonStream.str();
+        assert(count(csv.begin(), csv.end(), '\n') == 11 && csv.compare(0, 18, "backend,operation,") == 0);
+        assert(count(json.begin(), json.end(), '{') == 10);
+
+        log("[Unit Test]: Benchmark: 6 test cases passed");
+    }
+
+    // Test the batch mode output in both formats, with one worker and several
+    void testBatchQueries() {
+        Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
+
+        vector<string> words = { "apple", "app", "application", "car", "cat", "cart", "care" };
+        for (const string& word : words) trie.insert(word);
+
+        // Write the input to a temporary file and return what the batch writes
+        auto runBatch = [&trie](const string& text, bool json, unsigned workerCount) {
+            FILE* input = tmpfile();
+            FILE* output = tmpfile();
+            string result;
+
+            if (input && output) {
+                fwrite(text.data(), 1, text.size(), input);
+                rewind(input);
+
+                BatchQueries(trie, 2, json, workerCount).run(input, output);
+
+                rewind(output);
+                char buffer[4096];
+                size_t count;
+                while ((count = fread(buffer, 1, sizeof(buffer), output)) > 0) result.append(buffer, count);
+            }
+
+            if (input) fclose(input);
+            if (output) fclose(output);
+            return result;
+        };
+
+        string text = "prefix ca\r\nap\n\nregex ca.\nfuzzy cas 1\nfuzzy cat x\nsuffix at\nzz";
+        assert(runBatch(text, false, 1) ==
+            "prefix\tca\tcar\tcare\n"
+            "prefix\tap\tapp\tapple\n"
+            "regex\tca.\tcar\tcat\n"
+            "fuzzy\tcas\tcar\tcat\n"
+            "error\tbad distance\tfuzzy cat x\n"
+            "error\tunknown type\tsuffix at\n"
+            "prefix\tzz\n");
+
+        assert(runBatch("fuzzy cas 1\nsuffix \"at\"\n", true, 1) ==
+            "{\"type\":\"fuzzy\",\"query\":\"cas\",\"distance\":1,\"results\":[\"car\",\"cat\"]}\n"
+            "{\"error\":\"unknown type\",\"line\":\"suffix \\\"at\\\"\"}\n");
+
+        // Several blocks split across workers come back in order
+        string many;
+        for (int i = 0; i < 20000; i++) {
+            many += (i % 3 == 0 ? "prefix " : i % 3 == 1 ? "fuzzy " : "regex ") + words[i % words.size()].substr(0, 1 + i % 4) + "\n";
+        }
+        assert(runBatch(many, false, 3) == runBatch(many, false, 1));
+
+        log("[Unit Test]: Batch queries: 3 test cases passed");
+    }
+
+    // Test that a batch gives the same suggestions as one query at a time, in the query order
+    void testSuggestBatch() {
+        Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
+
+        vector<string> words = { "apple", "apa", "banana", "app", "application", "mango", "apprehensive", "car", "cat", "cart", "care", "a", "ap", "apply", "applied" };
+        for (const string& word : words) trie.insert(word);
+
+        vector<string> queries = { "app", "a", "appl", "", "car", "ca", "zz", "apple", "app", "apz", "c.r", "applic", "b", "ap", "appli" };
+        bool same = true;
+        for (int limit : { 0, 1, 2, 3, 100 }) {
+            vector<vector<string>> batch = trie.suggestBatch(queries, limit);
+
+            same = same && batch.size() == queries.size();
+            for (size_t i = 0; same && i < queries.size(); i++) {
+                same = batch[i] == trie.suggest(queries[i], limit);
+            }
+        }
+        assert(same);
+
+        // Results come back in the order of the queries
+        vector<vector<string>> batch = trie.suggestBatch({ "car", "apr", "appl" }, 2);
+        assert(batch[0] == vector<string>({ "car", "care" }) && batch[1].empty() && batch[2] == vector<string>({ "apple", "application" }));
+
+        // Split across threads, every prefix of every word
+        vector<string> many;
+        for (int round = 0; round < 20; round++) {
+            for (const string& word : words) {
+                for (size_t length = 0; length <= word.size(); length++) many.push_back(word.substr(0, length));
+            }
+        }
+        vector<vector<string>> single = trie.suggestBatch(many, 3, 1);
+        assert(trie.suggestBatch(many, 3, 4) == single);
+
+        // Queries sharing their first 8 bytes are still ordered by the rest, and every list
+        // is trimmed to the limit after the queries extending it used its extra word
+        for (size_t i = 0; same && i < many.size(); i++) same = single[i] == trie.suggest(many[i], 3);
+        assert(same);
+
+        log("[Unit Test]: Suggest batch: 4 test cases passed");
+    }
+
+    // Test that fuzzySearch gives the same results from the deletion index and keeps it in sync
+    void testDeletionIndex() {
+        Trie indexed, reference;
+        indexed.setLogging(false);
+        indexed.setCaching(false);
+        reference.setLogging(false);
+        reference.setCaching(false);
+
+        vector<string> words = { "apple", "apa", "banana", "app", "application", "mango", "apprehensive", "car", "clr", "cat", "cart", "care", "a", "ap", "aaaa" };
+
+        // Built before the words go in, the index follows the inserts
+        indexed.setDeletionIndex(2);
+        for (const string& word : words) {
+            indexed.insert(word);
+            reference.insert(word);
+        }
+
+        vector<string> queries = { "apple", "aple", "banan", "car", "xyz", "", "applications", "ca", "aaa", "pa" };
+        auto same = [&]() {
+            for (string query : queries) {
+                // A negative distance matches nothing, with or without the index
+                for (int distance = -1; distance <= 3; distance++) {
+                    for (int limit : { 1, 3, 100 }) {
+                        if (indexed.fuzzySearch(query, distance, limit) != reference.fuzzySearch(query, distance, limit)) return false;
+                    }
+                }
+            }
+            return true;
+        };
+        assert(same());
+
+        // Removing and inserting again
+        for (Trie* trie : { &indexed, &reference }) {
+            trie->remove("cat");
+            trie->remove("apa");
+            trie->insert("cap");
+            trie->insert("apa");
+        }
+        assert(same());
+        string query = "cat";
+        assert(indexed.fuzzySearch(query, 1, 10) == vector<string>({ "cap", "car", "cart" }));
+
+        // Built from the words already in the trie
+        indexed.setDeletionIndex(0);
+        indexed.setDeletionIndex(1);
+        assert(same());
+
+        // The bulk loaders and releaseTrie rebuild or clear it
+        indexed.releaseTrie();
+        assert(indexed.fuzzySearch(query, 1, 10).empty());
+
+        vector<string> sorted = words;
+        sort(sorted.begin(), sorted.end());
+        reference.releaseTrie();
+        indexed.buildFromSorted(sorted.begin(), sorted.end());
+        reference.buildFromSorted(sorted.begin(), sorted.end());
+        assert(same());
+
+        log("[Unit Test]: Deletion index: 5 test cases passed");
+    }
+
+    // Test that removed nodes are reused and that a released trie can be rebuilt
+    void testNodePool() {
+        Trie trie;
+
+        trie.setLogging(false);
+
+        trie.insert("hello");
+        trie.insert("help");
+        assert(trie.getNodeCount() == 7);
+
+        // Removing and inserting again takes the nodes back from the free list
+        trie.remove("help");
+        assert(trie.getNodeCount() == 6);
+        trie.insert("helm");
+        assert(trie.getNodeCount() == 7);
+        assert(trie.searchPrefix("hello")->isEndOfWord == true);
+        assert(trie.searchPrefix("helm")->isEndOfWord == true);
+
+        trie.releaseTrie();
+        assert(trie.getNodeCount() == 1);
+        assert(trie.searchPrefix("hello") == nullptr);
+
+        trie.insert("world");
+        assert(trie.searchPrefix("world")->isEndOfWord == true);
+
+        log("[Unit Test]: Node pool: 8 test cases passed");
+    }
+
+    // Test that children stay in alphabetical order while the packed arrays grow and shrink
+    void testSparseChildren() {
+        Trie trie;
+
+        trie.setLogging(false);
+
+        // Insert in reverse order so that every new child goes in front of the others
+        for (char c = 'z'; c >= 'a'; c--) {
+            trie.insert(string("x") + c);
+        }
+
+        vector<string> suggestions1 = trie.suggest("x", 26);
+
+        assert(suggestions1.size() == 26);
+        for (int i = 0; i < 26; i++) {
+            assert(suggestions1[i] == string("x") + (char)('a' + i));
+        }
+
+        // Remove every letter except "c" and "q"
+        for (char c = 'a'; c <= 'z'; c++) {
+            if (c != 'c' && c != 'q') trie.remove(string("x") + c);
+        }
+
+        vector<string> suggestions2 = trie.suggest("x", 26);
+
+        assert(suggestions2.size() == 2);
+        assert(suggestions2[0] == "xc");
+        assert(suggestions2[1] == "xq");
+        assert(trie.getNodeCount() == 4);
+
+        log("[Unit Test]: Sparse children: 30 test cases passed");
+    }
+
+    // Test that the radix trie splits and merges edges and answers like the trie
+    void testRadixTrie() {
+        Trie trie;
+        RadixTrie radixTrie;
+
+        trie.setLogging(false);
+        radixTrie.setLogging(false);
+
+        vector<string> words = { "romane", "romanus", "romulus", "rubens", "ruber", "rubicon", "rubicundus", "rub" };
+        for (const string& word : words) {
+            trie.insert(word);
+            radixTrie.insert(word);
+        }
+
+        // root, r, om, an, e, us, ulus, ub, e, ns, r, ic, on, undus
+        assert(radixTrie.getNodeCount() == 14);
+        assert(radixTrie.contains("rub") == true);
+        assert(radixTrie.contains("ru") == false);
+
+        assert(radixTrie.suggest("rom", 10) == trie.suggest("rom", 10));
+        assert(radixTrie.suggest("rubi", 10) == trie.suggest("rubi", 10));
+        assert(radixTrie.suggest("r.b[^i]..", 10) == trie.suggest("r.b[^i]..", 10));
+
+        string query = "rubes";
+        assert(radixTrie.fuzzySearch(query, 2, 10) == trie.fuzzySearch(query, 2, 10));
+
+        // Removing "romulus" leaves "om" with a single child, which is merged into "oman"
+        radixTrie.remove("romulus");
+        trie.remove("romulus");
+        assert(radixTrie.getNodeCount() == 12);
+        assert(radixTrie.suggest("ro", 10) == trie.suggest("ro", 10));
+
+        log("[Unit Test]: Radix trie: 8 test cases passed");
+    }
+
+    // Test that the frozen LOUDS trie answers like the trie it was built from
+    void testFreeze() {
+        Trie trie;
+
+        trie.setLogging(false);
+
+        vector<string> words = { "apple", "app", "appetite", "banana", "band", "bandana", "can", "cane", "zebra" };
+        for (const string& word : words) {
+            trie.insert(word);
+        }
+
+        LoudsTrie frozen = trie.freeze();
+        frozen.setLogging(false);
+
+        assert(frozen.getNodeCount() == trie.getNodeCount());
+        assert(frozen.isEndOfWord(frozen.searchPrefix("app")) == true);
+        assert(frozen.isEndOfWord(frozen.searchPrefix("ban")) == false);
+        assert(frozen.searchPrefix("apz") == LoudsTrie::NOT_FOUND);
+
+        assert(frozen.suggest("ap", 10) == trie.suggest("ap", 10));
+        assert(frozen.suggest("ban", 2) == trie.suggest("ban", 2));
+        assert(frozen.suggest("[bc]an.", 10) == trie.suggest("[bc]an.", 10));
+
+        string query = "bend";
+        assert(frozen.fuzzySearch(query, 2, 10) == trie.fuzzySearch(query, 2, 10));
+
+        log("[Unit Test]: Freeze: 8 test cases passed");
+    }
+
+    // Test that a saved snapshot maps back into a trie answering like the original
+    void testSnapshot() {
+        Trie trie;
+        const string filename = "unit_test_snapshot.bin";
+
+        trie.setLogging(false);
+
+        vector<string> words = { "apple", "app", "appetite", "banana", "band", "bandana", "can", "cane", "zebra" };
+        for (const string& word : words) {
+            trie.insert(word);
+        }
+
+        assert(trie.saveSnapshot(filename) == true);
+
+        LoudsTrie snapshot;
+        snapshot.setLogging(false);
+
+        assert(snapshot.loadSnapshot(filename) == true);
+        assert(snapshot.getNodeCount() == trie.getNodeCount());
+        assert(snapshot.isEndOfWord(snapshot.searchPrefix("band")) == true);
+        assert(snapshot.suggest("ap", 10) == trie.suggest("ap", 10));
+        assert(snapshot.suggest("[bc]an.", 10) == trie.suggest("[bc]an.", 10));
+
+        string query = "bend";
+        assert(snapshot.fuzzySearch(query, 2, 10) == trie.fuzzySearch(query, 2, 10));
+
+        // Flip one byte of the labels, the checksum has to reject the file
+        {
+            fstream file(filename, ios::in | ios::out | ios::binary);
+            file.seekg(-8, ios::end);
+            char c = file.get();
+            file.seekp(-8, ios::end);
+            file.put(c ^ 1);
+        }
+
+        LoudsTrie corrupted;
+        corrupted.setLogging(false);
+        assert(corrupted.loadSnapshot(filename) == false);
+
+        {
+            ofstream file(filename, ios::binary | ios::trunc);
+            file << "not a snapshot";
+        }
+        assert(corrupted.loadSnapshot(filename, false) == false);
+
+        std::remove(filename.c_str());
+
+        log("[Unit Test]: Snapshot: 9 test cases passed");
+    }
+
+    // Test that the sharded parallel load builds the same trie as inserting word by word
+    void testParallelLoad() {
+        Trie serial;
+        Trie parallel;
+        const string filename = "unit_test_dictionary.txt";
+
+        serial.setLogging(false);
+        parallel.setLogging(false);
+
+        vector<string> words = { "a", "i", "apple", "app", "appetite", "ab", "banana", "band", "bandana",
+            "can", "cane", "cat", "zebra", "zoo", "zoom", "quick", "quiz", "mississippi" };
+        {
+            ofstream file(filename);
+            for (const string& word : words) file << word << "\n";
+        }
+
+        // Words already in the trie leave their shard ("ap") to the serial path
+        serial.insert("apply");
+        parallel.insert("apply");
+
+        for (const string& word : words) {
+            serial.insert(word);
+        }
+        parallel.loadDictionaryParallel(filename, 3);
+
+        std::remove(filename.c_str());
+
+        assert(parallel.getNodeCount() == serial.getNodeCount());
+        assert(parallel.suggest("", 100) == serial.suggest("", 100));
+        assert(parallel.searchPrefix("ab")->isEndOfWord == true);
+        assert(parallel.searchPrefix("zo")->isEndOfWord == false);
+
+        // The adopted pools must keep working for removal and new insertions
+        parallel.remove("bandana");
+        parallel.remove("mississippi");
+        parallel.insert("bandit");
+        serial.remove("bandana");
+        serial.remove("mississippi");
+        serial.insert("bandit");
+
+        assert(parallel.getNodeCount() == serial.getNodeCount());
+        assert(parallel.suggest("", 100) == serial.suggest("", 100));
+
+        // The chain below "aa" fills the whole first arena slab of its pool (16384 slots), so
+        // the child block the stitching adds to the root has to start a new slab. The pools
+        // after it must still land where they were rebased to
+        Trie chainSerial;
+        Trie chainParallel;
+
+        chainSerial.setLogging(false);
+        chainParallel.setLogging(false);
+
+        words = { "aa" + string(16384, 'x'), "bbc", "bbd", "cca", "ccb", "dd" };
+        {
+            ofstream file(filename);
+            for (const string& word : words) file << word << "\n";
+        }
+
+        for (const string& word : words) {
+            chainSerial.insert(word);
+        }
+        chainParallel.loadDictionaryParallel(filename, 3);
+
+        std::remove(filename.c_str());
+
+        assert(chainParallel.getNodeCount() == chainSerial.getNodeCount());
+        assert(chainParallel.suggest("", 10) == chainSerial.suggest("", 10));
 
-    // Test cache manager
-public:
-    TrieUnitTests() {
-        runAllTests();
+        log("[Unit Test]: Parallel load: 8 test cases passed");
     }
-};
 
-// Trie performance tests
-class TriePerformanceTests {
-private:
-    Trie trie;
+    // Test the bulk load from sorted words against word by word insertion
+    void testBuildFromSorted() {
+        Trie inserted;
+        Trie built;
 
-    void runAllTest() {
-        pair<int, int> runtime_comparisons;
-        int simulationPerCase = 10;
-        int limits[] = { 100, 500, 1000, 5000, 10000 };
+        inserted.setLogging(false);
+        built.setLogging(false);
 
-        // Test insertion
-        for (int limit : limits) {
-            int totalInsertionTime = 0;
+        vector<string> words = { "a", "app", "appetite", "apple", "apple", "band", "bandana", "banner", "can", "cane", "zebra" };
+        for (const string& word : words) {
+            inserted.insert(word);
+        }
 
-            for (int i = 0; i < simulationPerCase; i++) {
-				totalInsertionTime += testInsertion(limit);
-            }
+        assert(built.buildFromSorted(words.begin(), words.end()) == true);
+        assert(built.getNodeCount() == inserted.getNodeCount());
+        assert(built.suggest("", 100) == inserted.suggest("", 100));
+        assert(built.searchPrefix("appl")->isEndOfWord == false);
 
-            log("[Performance Test]: Average insertion time with " + to_string(limit) + " words: " + to_string(totalInsertionTime / simulationPerCase) + " ms\n", GREEN);
-        }
+        // Out of order input is rejected before any word goes in
+        Trie unsorted;
+        unsorted.setLogging(false);
+        unsorted.insert("zoo");
 
-        // Test suggest
-        int wordLimits[] = { 1, 5, 10, 15, 20 };
+        vector<string> shuffled = { "apple", "banana", "app", "cane" };
+        assert(unsorted.buildFromSorted(shuffled.begin(), shuffled.end()) == false);
+        assert(unsorted.searchPrefix("apple") == nullptr);
+        assert(unsorted.suggest("", 10) == vector<string>({ "zoo" }));
 
-        for (int wordLimit : wordLimits) {
-            for (int limit : limits) {
-                int totalSuggestTime = 0;
-				int comparisons = 0;
+        log("[Unit Test]: Build from sorted: 7 test cases passed");
+    }
 
-                for (int i = 0; i < simulationPerCase; i++) {
-					runtime_comparisons = testSuggest(limit, wordLimit);
-					totalSuggestTime += runtime_comparisons.first;
-					comparisons += runtime_comparisons.second;
-                }
+    // Test that ranked suggestions follow the scores through insertions, updates and removals
+    void testRankedSuggest() {
+        Trie trie;
 
-                log("[Performance Test]: Average suggest time with " + to_string(limit) + " words and " + to_string(wordLimit) + " words limit: " + to_string(totalSuggestTime / simulationPerCase) + " ms", GREEN);
-				log("[Performance Test]: Total comparisons: " + to_string(comparisons / simulationPerCase) + "\n", GREEN);
-            }
+        trie.setLogging(false);
 
+        trie.insert("apple", 50);
+        trie.insert("app", 10);
+        trie.insert("appetite", 5);
+        trie.insert("application", 50);
+        trie.insert("apply", 20);
+        trie.insert("banana", 99);
+
+        // Equal scores fall back to alphabetical order
+        assert(trie.suggestRanked("app", 3) == vector<string>({ "apple", "application", "apply" }));
+        assert(trie.suggestRanked("", 2) == vector<string>({ "banana", "apple" }));
+        assert(trie.suggest("app", 2) == vector<string>({ "app", "appetite" }));
+
+        assert(trie.setScore("appetite", 100) == true);
+        assert(trie.suggestRanked("app", 1) == vector<string>({ "appetite" }));
+        assert(trie.setScore("appe", 1) == false);
+
+        // The best scores on the path have to drop with the removed word
+        trie.remove("appetite");
+        assert(trie.searchPrefix("app")->maxScore == 50);
+        trie.insert("apple", 1);
+        assert(trie.suggestRanked("ap", 2) == vector<string>({ "application", "apply" }));
+
+        // Without scores the ranking is the alphabetical order
+        Trie unscored;
+        unscored.setLogging(false);
+
+        vector<string> words = { "cane", "can", "candle", "cat", "car" };
+        for (const string& word : words) {
+            unscored.insert(word);
         }
+        assert(unscored.suggestRanked("ca", 10) == unscored.suggest("ca", 10));
 
-        // Test removal
-        for (int limit : limits) {
-            int totalRemovalTime = 0;
+        // Scores given in the dictionary file, through both loaders
+        const string filename = "unit_test_scores.txt";
+        {
+            ofstream file(filename);
+            file << "apple\t5\nbanana\t9\napp\nbandana\t7\n";
+        }
 
-            for (int i = 0; i < simulationPerCase; i++) {
-				totalRemovalTime += testRemoval(limit);
-            }
+        Trie loaded;
+        Trie loadedParallel;
+        loaded.setLogging(false);
+        loadedParallel.setLogging(false);
 
-            log("[Performance Test]: Average removal time with " + to_string(limit) + " words: " + to_string(totalRemovalTime / simulationPerCase) + " ms\n", GREEN);
-        }
+        loaded.loadDictionary(filename);
+        loadedParallel.loadDictionaryParallel(filename, 2);
+        std::remove(filename.c_str());
 
+        vector<string> expected = { "banana", "bandana", "apple", "app" };
+        assert(loaded.suggestRanked("", 10) == expected);
+        assert(loadedParallel.suggestRanked("", 10) == expected);
+
+        log("[Unit Test]: Ranked suggest: 11 test cases passed");
     }
 
-    int testInsertion(int limit) {
-        ifstream ifile("words_alpha.txt");
-        string word;
+    // Test readers running while a writer changes the trie in concurrent mode
+    void testConcurrentReads() {
         Trie trie;
+        Trie expected;
 
-		trie.setLogging(false);
+        trie.setLogging(false);
+        expected.setLogging(false);
 
-        if (!ifile.is_open()) {
-            log("[Performance Test]: Error opening file", RED);
-            return -1;
+        vector<string> stable = { "apple", "app", "banana", "band", "can", "cane", "zebra" };
+        vector<string> churn = { "apply", "applet", "bandit", "canal", "zeal", "ban", "c" };
+
+        for (const string& word : stable) {
+            trie.insert(word, 10);
+            expected.insert(word, 10);
         }
 
-        vector<string> words;
+        trie.setConcurrentReads(true);
 
-        while (getline(ifile, word) && words.size() < limit) {
-            words.push_back(word);
-        }
+        atomic<bool> done(false);
+        atomic<int> failures(0);
+        vector<thread> readers;
 
-        ifile.close();
+        for (int t = 0; t < 3; t++) {
+            readers.emplace_back([&]() {
+                while (!done.load()) {
+                    for (const string& word : stable) {
+                        if (!trie.contains(word)) failures++;
+                    }
 
-        auto start = high_resolution_clock::now();
+                    vector<string> results = trie.suggest("", 100);
+                    if (!is_sorted(results.begin(), results.end()) || results.size() < stable.size()) failures++;
 
-        for (const string& word : words) {
-            trie.insert(word);
+                    vector<string> ranked = trie.suggestRanked("ban", 1);
+                    if (ranked.empty()) failures++;
+                }
+                });
         }
 
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start);
+        // Insert, rescore and remove the churn words over and over
+        for (int round = 0; round < 200; round++) {
+            for (const string& word : churn) trie.insert(word, round);
+            trie.setScore("band", round);
+            for (const string& word : churn) trie.remove(word);
+        }
+        for (const string& word : churn) trie.insert(word);
 
-        log("[Performance Test]: Insertion of " + to_string(limit) + " words executed in " + to_string(duration.count()) + " ms");
+        done = true;
+        for (thread& reader : readers) reader.join();
 
-        return duration.count();
-    }
+        trie.remove("band");
 
-    pair<int, int> testSuggest(int limit, int wordLimit) {
-        ifstream ifile("prefixes.txt");
-        string prefix;
+        trie.setConcurrentReads(false);
 
-        if (!ifile.is_open()) {
-            log("[Performance Test]: Error opening file", RED);
-			return { -1, -1 };
-        }
+        for (const string& word : churn) expected.insert(word);
+        expected.remove("band");
 
-        vector<string> prefixes;
+        assert(failures.load() == 0);
+        assert(trie.suggest("", 100) == expected.suggest("", 100));
+        assert(trie.contains("band") == false);
 
-        while (getline(ifile, prefix) && prefixes.size() < limit) {
-            prefixes.push_back(prefix);
-        }
+        // Once the retired nodes are released nothing is left over
+        assert(trie.getNodeCount() == expected.getNodeCount());
 
-        ifile.close();
+        // A reader that finds every slot taken waits for one to be handed back
+        EpochManager epochs;
+        vector<int> taken;
+        for (int i = 0; i < epochs.getSlotCount(); i++) taken.push_back(epochs.enter());
 
+        atomic<int> late(-1);
+        thread waiter([&]() { late = epochs.enter(); });
 
-        auto start = high_resolution_clock::now();
+        this_thread::sleep_for(milliseconds(20));
+        bool blocked = late.load() == -1;
+        epochs.exit(taken.back());
+        waiter.join();
 
-        for (const string& prefix : prefixes) {
-            trie.suggest(prefix, wordLimit);
-            //cout << prefix << ": current comparisons: " << trie.comparisons << "\n";
+        assert(blocked && late.load() == taken.back());
+
+        log("[Unit Test]: Concurrent reads: 5 test cases passed");
+    }
+
+    // Test the LFU eviction order, invalidation and sharded use from several threads
+    void testCacheManager() {
+        CacheManager cache(3);
+        vector<string> suggestions;
+
+        cache.setLogging(false);
+
+        cache.insert("a", { "apple" });
+        cache.insert("b", { "banana" });
+        cache.insert("c", { "cane" });
+        cache.get("a", 1, suggestions);
+        cache.get("a", 1, suggestions);
+        cache.get("b", 1, suggestions);
+
+        // "c" is the least frequently used, then "d" the oldest of the entries used once
+        cache.insert("d", { "dog" });
+        assert(cache.get("c", 1, suggestions) == false);
+        cache.insert("e", { "eagle" });
+        assert(cache.get("d", 1, suggestions) == false);
+        assert(cache.get("a", 1, suggestions) == true && suggestions == vector<string>({ "apple" }));
+        assert(cache.getSize() == 3);
+
+        // A miss or a request for more suggestions than cached stores nothing
+        assert(cache.get("zebra", 1, suggestions) == false);
+        assert(cache.get("e", 2, suggestions) == false);
+        assert(cache.getSize() == 3);
+
+        // Results computed before an invalidation are not cached
+        uint64_t generation = cache.getGeneration();
+        cache.remove("b");
+        cache.insert("f", { "fox" }, generation);
+        assert(cache.get("b", 1, suggestions) == false);
+        assert(cache.get("f", 1, suggestions) == false);
+
+        CacheManager sharded(1000, 8);
+        sharded.setLogging(false);
+
+        vector<thread> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&sharded, t]() {
+                vector<string> found;
+
+                for (int i = 0; i < 2000; i++) {
+                    string key = to_string((i * 7 + t) % 1500);
+
+                    if (!sharded.get(key, 1, found)) sharded.insert(key, { key });
+                    else assert(found[0] == key);
+                }
+                });
         }
+        for (thread& worker : workers) worker.join();
 
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start);
-		int comparisons = trie.comparisons;
+        assert(sharded.getSize() <= sharded.getCapacity());
 
-		// Reset the comparison counter
-		trie.comparisons = 0;
+        log("[Unit Test]: Cache manager: 10 test cases passed");
+    }
 
-        log("[Performance Test]: Suggest of " + to_string(limit) + " words with " + to_string(wordLimit) + " words limit executed in " + to_string(duration.count()) + " ms");
-		log("[Performance Test]: Total comparisons: " + to_string(comparisons));
+    // Test that a write only drops the cache entries it can change
+    void testCacheInvalidation() {
+        Trie trie;
+        trie.setLogging(false);
 
-		return { duration.count(), comparisons };
+        vector<string> words = { "apple", "app", "band", "banana", "can", "cane" };
+        for (const string& word : words) trie.insert(word);
+
+        string query = "cant";
+        trie.suggest("ap");
+        trie.suggest("b");
+        trie.suggest("ca.");
+        trie.suggest("b..d");
+        trie.fuzzySearch(query, 1);
+        assert(trie.getCacheSize() == 5);
+
+        // The suggestions of a cached prefix include a word inserted afterwards
+        trie.insert("apt");
+        assert(trie.suggest("ap") == vector<string>({ "app", "apple", "apt" }));
+        assert(trie.getCacheSize() == 5);
+
+        // Only the regex and fuzzy entries the word matches are dropped
+        trie.insert("cat");
+        assert(trie.getCacheSize() == 3);
+        assert(trie.suggest("ca.") == vector<string>({ "can", "cat" }));
+        vector<string> fuzzy = trie.fuzzySearch(query, 1);
+        sort(fuzzy.begin(), fuzzy.end());
+        assert(fuzzy == vector<string>({ "can", "cane", "cat" }));
+
+        trie.remove("band");
+        assert(trie.suggest("b") == vector<string>({ "banana" }));
+        assert(trie.suggest("b..d").empty());
+
+        // Clearing the cache also forgets the groups, so a later write finds nothing to drop
+        trie.suggest("ca.");
+        trie.releaseTrie();
+        trie.insert("cab");
+        assert(trie.suggest("ca.") == vector<string>({ "cab" }));
+
+        // A huge distance is capped, and the entry is still dropped by a write within reach
+        assert(trie.fuzzySearch(query, INT_MAX, 100).size() == 1);
+        trie.insert("zebra");
+        assert(trie.fuzzySearch(query, INT_MAX, 100).size() == 2);
+
+        // Replacing an entry moves it to the group it was stored with last
+        CacheManager cache(10);
+        cache.setLogging(false);
+        auto isGroup = [](int wanted) { return [wanted](int group) { return group == wanted; }; };
+        cache.insert("x", { "xa" }, cache.getGeneration(), 1);
+        cache.insert("x", { "xb" }, cache.getGeneration(), 2);
+        cache.removeAffected(isGroup(1), "xb");
+        assert(cache.getSize() == 1);
+        cache.removeAffected(isGroup(2), "xb");
+        assert(cache.getSize() == 0);
+
+        // An entry with its own test is only dropped by the words it names
+        cache.insert("y", { "ya" }, cache.getGeneration(), 1, [](const string& word) { return word == "ya"; });
+        cache.removeAffected(isGroup(1), "yb");
+        assert(cache.getSize() == 1);
+        cache.removeAffected(isGroup(1), "ya");
+        assert(cache.getSize() == 0);
+
+        log("[Unit Test]: Cache invalidation: 14 test cases passed");
     }
 
-    int testRemoval(int limit) {
-        ifstream ifile("words_alpha.txt");
-        string word;
+    // Test that a session answers every keystroke like suggest, also after the trie changes
+    void testCompletionSession() {
         Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
 
-		trie.setLogging(false);
+        vector<string> words = { "app", "apple", "apply", "apt", "ban", "band", "banana", "bandana", "can" };
+        for (const string& word : words) trie.insert(word);
 
-        if (!ifile.is_open()) {
-            log("[Performance Test]: Error opening file", RED);
-            return  -1;
+        CompletionSession session(trie, 2);
+        session.push('a');
+        session.push('p');
+        assert(session.push('p') == vector<string>({ "app", "apple" }));
+        assert(session.push('l') == vector<string>({ "apple", "apply" }));
+        assert(session.pop() == vector<string>({ "app", "apple" }));
+        assert(session.push('X').empty() && session.pop().size() == 2);
+
+        // Typing and erasing every word gives the same completions as suggest
+        bool same = true;
+        for (const string& word : words) {
+            session.clear();
+
+            for (size_t i = 0; i < word.size(); i++) {
+                same = same && session.push(word[i]) == trie.suggest(word.substr(0, i + 1), 2);
+            }
+            for (size_t i = word.size(); i-- > 0;) {
+                same = same && session.pop() == trie.suggest(word.substr(0, i), 2);
+            }
         }
+        assert(same);
+
+        session.clear();
+        session.push('a');
+        session.push('p');
+        trie.insert("apex");
+        assert(session.suggestions() == vector<string>({ "apex", "app" }));
+        trie.remove("apex");
+        assert(session.push('p') == vector<string>({ "app", "apple" }));
+
+        trie.setConcurrentReads(true);
+        trie.insert("appa");
+        assert(session.pop() == vector<string>({ "app", "appa" }));
+        trie.setConcurrentReads(false);
+
+        log("[Unit Test]: Completion session: 8 test cases passed");
+    }
 
-        vector<string> words;
+    // Test that the buffer and visitor APIs answer like suggest
+    void testSuggestInto() {
+        Trie trie;
+        trie.setLogging(false);
 
-        while (getline(ifile, word) && words.size() < limit) {
-            words.push_back(word);
+        vector<string> words = { "app", "apple", "apply", "apt", "ban", "band", "banana", "bandana", "can", "cane" };
+        for (const string& word : words) trie.insert(word);
+
+        SuggestionBuffer buffer;
+        bool same = true;
+        for (string prefix : { "", "a", "app", "band", "c", "z" }) {
+            vector<string> expected = trie.suggest(prefix, 3);
+
+            same = same && trie.suggestInto(prefix, 3, buffer) == (int)expected.size() && buffer.size() == expected.size();
+            for (size_t i = 0; i < buffer.size() && same; i++) {
+                same = buffer.word(i) == expected[i] && buffer.length(i) == expected[i].size();
+            }
         }
+        assert(same);
+
+        // A regex is answered in alphabetical order
+        vector<string> expected = trie.suggest("[cb]an.");
+        sort(expected.begin(), expected.end());
+        assert(trie.suggestInto("[cb]an.", 10, buffer) == 2 && buffer.word(0) == expected[0] && buffer.word(1) == expected[1]);
+        assert(trie.suggestInto("[ab", 10, buffer) == 0 && buffer.empty());
+
+        // The visitor sees every word in order and the limit stops the search
+        string scratch;
+        vector<string> visited;
+        int count = trie.visitSuggestions("ap", 3, scratch, [&visited](const string& word) { visited.push_back(word); });
+        assert(count == 3 && visited == vector<string>({ "app", "apple", "apply" }));
+        assert(trie.visitSuggestions("ap", 0, scratch, [](const string&) {}) == 0);
+
+        log("[Unit Test]: Suggest into a buffer: 5 test cases passed");
+    }
 
-        ifile.close();
+    // Test that pages resumed from tokens cover the same words as one long suggest
+    void testCompletionIterator() {
+        Trie trie;
+        trie.setLogging(false);
+
+        vector<string> words = { "ap", "app", "apple", "apply", "apt", "apex", "ban", "band", "can" };
+        for (const string& word : words) trie.insert(word);
+
+        vector<string> paged;
+        string token;
+        int pages = 0;
+
+        while (true) {
+            CompletionIterator iterator(trie, "ap", token);
+            vector<string> page = iterator.nextPage(2);
 
+            paged.insert(paged.end(), page.begin(), page.end());
+            token = iterator.token();
+            pages++;
+            if (page.size() < 2) break;
+        }
+        assert(paged == trie.suggest("ap", 100));
+        assert(pages == 4);
+
+        // A token stays valid after its word is removed
+        CompletionIterator first(trie, "ap");
+        first.nextPage(3);
+        assert(first.token() == "2:app");
+        trie.remove("app");
+        assert(CompletionIterator(trie, "ap", "2:app").nextPage(2) == vector<string>({ "apple", "apply" }));
+
+        // Tokens of another prefix or malformed ones give nothing
+        assert(CompletionIterator(trie, "ba", "2:app").nextPage(2).empty());
+        assert(CompletionIterator(trie, "ap", "x:apple").nextPage(2).empty());
+        assert(CompletionIterator(trie, "zz").nextPage(2).empty());
+
+        // Once the walk is over the token still points after the last word, so resuming
+        // from the final page gives nothing instead of starting again
+        CompletionIterator exhausted(trie, "ca");
+        trie.insert("car");
+        trie.insert("cart");
+        trie.insert("cat");
+        assert(exhausted.nextPage(10) == vector<string>({ "can", "car", "cart", "cat" }));
+        assert(exhausted.token() == "2:cat");
+        assert(CompletionIterator(trie, "ca", exhausted.token()).nextPage(10).empty());
+
+        // Between pages an iterator holds no nodes, it picks up the words after its position
+        // in the trie as it is now, also in concurrent mode
+        for (bool concurrent : { false, true }) {
+            trie.setConcurrentReads(concurrent);
+
+            CompletionIterator resumed(trie, "b");
+            assert(resumed.nextPage(1) == vector<string>({ "ban" }));
+            trie.insert("bake");
+            trie.insert("bana");
+            trie.remove("band");
+            assert(resumed.nextPage(5) == vector<string>({ "bana" }));
+            trie.remove("bake");
+            trie.remove("bana");
+            trie.insert("band");
+        }
+        trie.setConcurrentReads(false);
+
+        log("[Unit Test]: Completion iterator: 14 test cases passed");
+    }
+
+    // Test that the double-array trie relocates states correctly and answers like the trie
+    void testDoubleArray() {
+        Trie trie;
+        DoubleArrayTrie doubleArray;
+
+        trie.setLogging(false);
+        doubleArray.setLogging(false);
+
+        // Unsorted input forces children to be added to states that already have a base
+        vector<string> words = { "zebra", "apple", "app", "bandana", "appetite", "band", "banana", "can", "cane", "apply", "ban" };
         for (const string& word : words) {
             trie.insert(word);
+            doubleArray.insert(word);
         }
 
-        auto start = high_resolution_clock::now();
+        assert(doubleArray.getNodeCount() == trie.getNodeCount());
+        assert(doubleArray.isEndOfWord(doubleArray.searchPrefix("app")) == true);
+        assert(doubleArray.isEndOfWord(doubleArray.searchPrefix("band")) == true);
+        assert(doubleArray.searchPrefix("apz") == -1);
+
+        assert(doubleArray.suggest("ap", 10) == trie.suggest("ap", 10));
+        assert(doubleArray.suggest("[bc]an.", 10) == trie.suggest("[bc]an.", 10));
+
+        string query = "bend";
+        assert(doubleArray.fuzzySearch(query, 2, 10) == trie.fuzzySearch(query, 2, 10));
+
+        doubleArray.remove("bandana");
+        doubleArray.remove("apple");
+        trie.remove("bandana");
+        trie.remove("apple");
+
+        assert(doubleArray.getNodeCount() == trie.getNodeCount());
+        assert(doubleArray.suggest("", 20) == trie.suggest("", 20));
+
+        log("[Unit Test]: Double array: 9 test cases passed");
+    }
+
+    // Test that the DAFSA shares suffixes and still enumerates the same words as the trie
+    void testDafsa() {
+        Trie trie;
+        Dafsa dafsa;
+
+        trie.setLogging(false);
+        dafsa.setLogging(false);
 
+        vector<string> words = { "baking", "bakings", "making", "makings", "taking", "takings", "tasking", "tasks" };
         for (const string& word : words) {
-            trie.remove(word);
+            trie.insert(word);
         }
 
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start);
+        assert(dafsa.build(words) == true);
 
-        log("[Performance Test]: Removal of " + to_string(limit) + " words executed in " + to_string(duration.count()) + " ms");
+        // The "aking" / "akings" endings are stored once for all three first letters,
+        // which leaves 14 states for the 28 trie nodes
+        assert(trie.getNodeCount() == 28);
+        assert(dafsa.getNodeCount() == 14);
+        assert(dafsa.isEndOfWord(dafsa.searchPrefix("making")) == true);
+        assert(dafsa.isEndOfWord(dafsa.searchPrefix("mak")) == false);
+        assert(dafsa.searchPrefix("mark") == Dafsa::NOT_FOUND);
+
+        assert(dafsa.suggest("", 20) == trie.suggest("", 20));
+        assert(dafsa.suggest("ta", 3) == trie.suggest("ta", 3));
+        assert(dafsa.suggest("[bt]a.ing.", 10) == trie.suggest("[bt]a.ing.", 10));
+
+        string query = "tking";
+        assert(dafsa.fuzzySearch(query, 2, 10) == trie.fuzzySearch(query, 2, 10));
+
+        // Unsorted input is rejected and the previous automaton stays usable
+        assert(dafsa.build({ "taking", "baking" }) == false);
+        assert(dafsa.getNodeCount() == 14);
 
-		return duration.count();
+        log("[Unit Test]: DAFSA: 12 test cases passed");
     }
 
+    // Test cache manager
 public:
-    TriePerformanceTests() {
-		trie.setLogging(false);
-        trie.loadDictionary("words_alpha.txt");
-        runAllTest();
-
+    TrieUnitTests() {
+        runAllTests();
     }
 };
 
@@ -1177,10 +8107,11 @@ public:
     }
 };
 
-// Sorted Array performance tests
-class SortedArrayPerformanceTests {
+// Performance tests for any dictionary structure with insert, remove and suggest
+template <typename Dictionary>
+class PerformanceTests {
 private:
-    SortedArray sortedArray;
+    Dictionary dictionary;
 
     void runAllTest() {
 		pair<int, int> runtime_comparisons;
@@ -1230,9 +8161,10 @@ private:
     int testInsertion(int limit) {
         ifstream ifile("words_alpha.txt");
         string word;
-        SortedArray sortedArray;
+        Dictionary dictionary;
 
-		sortedArray.setLogging(false);
+		dictionary.setLogging(false);
+		disableCaching(dictionary);
 
         if (!ifile.is_open()) {
             log("[Performance Test]: Error opening file", RED);
@@ -1250,7 +8182,7 @@ private:
         auto start = high_resolution_clock::now();
 
         for (const string& word : words) {
-            sortedArray.insert(word);
+            dictionary.insert(word);
         }
 
         auto stop = high_resolution_clock::now();
@@ -1281,17 +8213,17 @@ private:
         auto start = high_resolution_clock::now();
 
         for (const string& prefix : prefixes) {
-            sortedArray.suggest(prefix, wordLimit);
-            //cout << prefix << ": current comparisons: " << sortedArray.comparisons << "\n";
+            dictionary.suggest(prefix, wordLimit);
+            //cout << prefix << ": current comparisons: " << dictionary.comparisons << "\n";
 
         }
 
         auto stop = high_resolution_clock::now();
         auto duration = duration_cast<milliseconds>(stop - start);
-		int comparisons = sortedArray.comparisons;
+		int comparisons = dictionary.comparisons;
         
 		// Reset the comparison counter
-		sortedArray.comparisons = 0;
+		dictionary.comparisons = 0;
 
         log("[Performance Test]: Suggest of " + to_string(limit) + " words with " + to_string(wordLimit) + " words limit executed in " + to_string(duration.count()) + " ms");
 		log("[Performance Test]: Total comparisons: " + to_string(comparisons));
@@ -1302,9 +8234,10 @@ private:
     int testRemoval(int limit) {
         ifstream ifile("words_alpha.txt");
         string word;
-        SortedArray sortedArray;
+        Dictionary dictionary;
 
-		sortedArray.setLogging(false);
+		dictionary.setLogging(false);
+		disableCaching(dictionary);
 
         if (!ifile.is_open()) {
             log("[Performance Test]: Error opening file", RED);
@@ -1320,13 +8253,13 @@ private:
         ifile.close();
 
         for (const string& word : words) {
-            sortedArray.insert(word);
+            dictionary.insert(word);
         }
 
         auto start = high_resolution_clock::now();
 
         for (const string& word : words) {
-            sortedArray.remove(word);
+            dictionary.remove(word);
         }
 
         auto stop = high_resolution_clock::now();
@@ -1338,14 +8271,19 @@ private:
     }
 
 public:
-    SortedArrayPerformanceTests() {
-        sortedArray.loadDictionary("words_alpha.txt");
-		sortedArray.setLogging(false);
+    PerformanceTests() {
+		dictionary.setLogging(false);
+		disableCaching(dictionary);
+        dictionary.loadDictionary("words_alpha.txt");
         runAllTest();
     }
 
 };
 
+typedef PerformanceTests<Trie> TriePerformanceTests;
+typedef PerformanceTests<SortedArray> SortedArrayPerformanceTests;
+typedef PerformanceTests<DoubleArrayTrie> DoubleArrayPerformanceTests;
+
 // UI class for the program
 class UI {
 private:
@@ -1358,7 +8296,7 @@ private:
     void logWordWithHighlight(string word, string query) {
         int i = 0, j = 0;
 		string result = "";
-        string wildCards = ".[]^";
+        string wildCards = REGEX_OPERATORS;
 
 		// Check if the query contains wildcards
 		bool isRegex = false;
@@ -1400,7 +8338,7 @@ private:
 		// Load the dictionary into the trie
         Trie trie;
 
-        trie.loadDictionary("words_alpha.txt");
+        trie.loadDictionaryParallel("words_alpha.txt");
         log("Dictionary loaded successfully! Press Enter to navigate to UI board.", GREEN);
         _getch();
 
@@ -1441,7 +8379,7 @@ private:
                         cin >> maxDistance;
 
                         start = high_resolution_clock::now();
-                        suggestions = trie.fuzzySearch(query, maxDistance, wordLimit);
+                        suggestions = trie.fuzzySearchBitParallel(query, maxDistance, wordLimit, true);
                         stop = high_resolution_clock::now();
                         duration = duration_cast<milliseconds>(stop - start);
 
@@ -1552,16 +8490,207 @@ private:
         _getch();
     }
 
+    void doubleArrayTestMode() {
+        cout << "Enter [1] for performance tests, [2] to exit: ";
+        int choice;
+        cin >> choice;
+
+        try {
+            if (choice == 1) {
+                DoubleArrayPerformanceTests tests;
+            }
+            else if (choice == 2) {
+                return;
+            }
+            else {
+                throw invalid_argument("Invalid choice");
+            }
+        }
+        catch (const exception& e) {
+			log("Tests failed: " + string(e.what()), RED);
+        }
+
+        log("[ * ] : All tests finished! Press Enter to continue.", GREEN);
+        _getch();
+    }
+
 public:
     UI() {
 
     }
 
+    // Run the micro-benchmarks, see Benchmark. Options: --backends trie,radix,double,dafsa,louds,sorted,
+    // --sizes <n,...> (0 for the whole dictionary), --limits <n,...> word limits for suggest,
+    // --out <file> to write the results, as JSON if the name ends in .json and CSV otherwise
+    bool benchMode(const vector<string>& args) {
+        vector<string> backends = { "trie", "radix", "double", "dafsa", "louds", "sorted" };
+        vector<size_t> sizes = { 10000, 100000, 0 };
+        vector<int> wordLimits = { 1, 10, 100 };
+        string outputName;
+
+        auto split = [](const string& list) {
+            vector<string> items;
+            size_t start = 0;
+
+            while (start <= list.size()) {
+                size_t end = list.find(',', start);
+                if (end == string::npos) end = list.size();
+                if (end > start) items.push_back(list.substr(start, end - start));
+                start = end + 1;
+            }
+
+            return items;
+        };
+
+        for (size_t i = 0; i < args.size(); i++) {
+            if (i + 1 == args.size()) {
+                log("[Benchmark]: Missing value for " + args[i], RED);
+                return false;
+            }
+
+            const string& value = args[++i];
+            if (args[i - 1] == "--backends") backends = split(value);
+            else if (args[i - 1] == "--out") outputName = value;
+            else if (args[i - 1] == "--sizes") {
+                sizes.clear();
+                for (const string& item : split(value)) sizes.push_back((size_t)max(0, atoi(item.c_str())));
+            }
+            else if (args[i - 1] == "--limits") {
+                wordLimits.clear();
+                for (const string& item : split(value)) wordLimits.push_back(max(1, atoi(item.c_str())));
+            }
+            else {
+                log("[Benchmark]: Unknown option " + args[i - 1], RED);
+                return false;
+            }
+        }
+
+        // Both files are read once for every run
+        vector<string> words, prefixes;
+        for (auto file : { make_pair("words_alpha.txt", &words), make_pair("prefixes.txt", &prefixes) }) {
+            ifstream ifile(file.first);
+            string line;
+
+            if (!ifile.is_open()) {
+                log("[Benchmark]: Error opening " + string(file.first), RED);
+                return false;
+            }
+
+            while (getline(ifile, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (!line.empty()) file.second->push_back(line);
+            }
+        }
+
+        Benchmark benchmark(words, prefixes);
+
+        for (const string& backend : backends) {
+            if (backend == "trie") benchmark.run<Trie>(backend, sizes, wordLimits);
+            else if (backend == "radix") benchmark.run<RadixTrie>(backend, sizes, wordLimits);
+            else if (backend == "double") benchmark.run<DoubleArrayTrie>(backend, sizes, wordLimits);
+            else if (backend == "dafsa") benchmark.run<Dafsa>(backend, sizes, wordLimits);
+            else if (backend == "louds") benchmark.run<LoudsTrie>(backend, sizes, wordLimits);
+            else if (backend == "sorted") benchmark.run<SortedArray>(backend, sizes, wordLimits);
+            else log("[Benchmark]: Unknown backend " + backend, RED);
+        }
+
+        if (!outputName.empty()) {
+            ofstream out(outputName);
+
+            if (!out.is_open()) {
+                log("[Benchmark]: Error opening " + outputName, RED);
+                return false;
+            }
+
+            bool json = outputName.size() >= 5 && outputName.compare(outputName.size() - 5, 5, ".json") == 0;
+            if (json) benchmark.writeJson(out);
+            else benchmark.writeCsv(out);
+
+            log("[Benchmark]: Results written to " + outputName, GREEN);
+        }
+
+        return true;
+    }
+
+    // Answer the queries of a file, or of stdin, see BatchQueries. Options: --json for JSON
+    // lines instead of TSV, --limit <n> words per query, --threads <n> workers. Only the
+    // results go to stdout, messages go to stderr
+    bool batchMode(const vector<string>& args) {
+        string inputName;
+        int wordLimit = 10;
+        unsigned workerCount = 1;
+        bool json = false;
+
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i] == "--json") json = true;
+            else if (args[i] == "--limit" && i + 1 < args.size()) wordLimit = max(0, atoi(args[++i].c_str()));
+            else if (args[i] == "--threads" && i + 1 < args.size()) workerCount = (unsigned)max(1, atoi(args[++i].c_str()));
+            else if (inputName.empty() && args[i].compare(0, 2, "--") != 0) inputName = args[i];
+            else {
+                cerr << "[Batch]: Unknown option " << args[i] << endl;
+                return false;
+            }
+        }
+
+        FILE* input = inputName.empty() ? stdin : fopen(inputName.c_str(), "rb");
+        if (!input) {
+            cerr << "[Batch]: Cannot open " << inputName << endl;
+            return false;
+        }
+
+        Trie trie;
+        trie.setLogging(false);
+        trie.setCaching(false);
+        trie.loadDictionaryParallel("words_alpha.txt");
+
+        if (trie.getNodeCount() <= 1) {
+            cerr << "[Batch]: Cannot load words_alpha.txt" << endl;
+            if (input != stdin) fclose(input);
+            return false;
+        }
+
+        auto start = high_resolution_clock::now();
+        size_t lines = BatchQueries(trie, wordLimit, json, workerCount).run(input, stdout);
+        double seconds = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+
+        if (input != stdin) fclose(input);
+
+        cerr << "[Batch]: " << lines << " lines in " << seconds << " s, " << (size_t)(lines / max(seconds, 1e-6)) << " lines/s" << endl;
+        return true;
+    }
+
+#ifdef __linux__
+    // Serve queries on a Unix domain socket until interrupted, see QueryServer
+    void serveMode(const string& path, unsigned workerCount) {
+        Trie trie;
+
+        trie.loadDictionaryParallel("words_alpha.txt");
+        if (trie.getNodeCount() <= 1) return;
+
+        // Logging is not thread-safe, and cache hits would log every request. The cache
+        // gets a shard per worker
+        trie.setLogging(false);
+        trie.setCacheCapacity(4096, max(1u, workerCount ? workerCount : thread::hardware_concurrency()));
+
+        QueryServer server(trie, path, workerCount);
+        if (!server.open()) return;
+
+        activeServer = &server;
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+
+        log("[Server]: Listening on " + path + ", stop with Ctrl+C", GREEN);
+        server.run();
+
+        activeServer = nullptr;
+    }
+#endif
+
     void run() {
         while (true) {
             system("cls");
 
-            log("Enter [1] for user mode, [2] for trie tests, [3] for sorted array tests, [4] to exit: ");
+            log("Enter [1] for user mode, [2] for trie tests, [3] for sorted array tests, [4] for double array tests, [5] to exit: ");
             int choice;
             cin >> choice;
 
@@ -1575,6 +8704,9 @@ public:
                 sortedArrayTestMode();
             }
             else if (choice == 4) {
+                doubleArrayTestMode();
+            }
+            else if (choice == 5) {
                 break;
             }
             else {
@@ -1585,11 +8717,33 @@ public:
     }
 };
 
-int main() {
+int main(int argc, char** argv) {
     auto start = high_resolution_clock::now();
 
     UI ui;
-    ui.run();
+
+    // trie_project --batch [input file] [--json] [--limit n] [--threads n]. Nothing else may
+    // be written to stdout
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return ui.batchMode(vector<string>(argv + 2, argv + argc)) ? 0 : 1;
+    }
+
+    // trie_project --bench [--backends list] [--sizes list] [--limits list] [--out file]
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return ui.benchMode(vector<string>(argv + 2, argv + argc)) ? 0 : 1;
+    }
+
+    // trie_project --serve [socket path] [worker count]
+    if (argc > 1 && string(argv[1]) == "--serve") {
+#ifdef __linux__
+        ui.serveMode(argc > 2 ? argv[2] : "/tmp/trie.sock", argc > 3 ? (unsigned)max(0, atoi(argv[3])) : 0);
+#else
+        log("[ ! ] : Server mode is only available on Linux", RED);
+#endif
+    }
+    else {
+        ui.run();
+    }
 
     auto stop = high_resolution_clock::now();
     auto duration = duration_cast<milliseconds>(stop - start);